@@ -0,0 +1,66 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+
+#include <iostream>
+
+struct number : public message_type {
+  uint64_t value;
+  explicit number(uint64_t value) : value(value) {}
+};
+
+// one tenant: a CPU-bound pipeline that runs for a few seconds
+void build(pipeline_system &system, std::chrono::steady_clock::time_point until) {
+  auto in = system.create_queue("numbers", 100);
+  auto out = system.create_queue("hashes", 100);
+  uint64_t i = 0;
+  system.spawn_producer(
+      "generate",
+      [=]() mutable -> std::shared_ptr<number> {
+        if (std::chrono::steady_clock::now() >= until) return nullptr;
+        return std::make_shared<number>(i++);
+      },
+      in);
+  for (int worker = 0; worker < 2; worker++) {
+    system.spawn_transformer<number>(
+        "hash " + std::to_string(worker),
+        [](auto n) {
+          uint64_t h = n->value;
+          for (int j = 0; j < 20000; j++) h = (h ^ (h >> 31)) * 0x9e3779b97f4a7c15ULL;
+          return std::make_shared<number>(h);
+        },
+        in,
+        out);
+  }
+  system.spawn_consumer<number>("sum", [](auto) {}, out);
+}
+
+int main() {
+  // two threads for everyone, however many nodes the tenants spawn
+  auto scheduler = std::make_shared<fair_scheduler>(2);
+  const auto until = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+
+  pipeline_system gold;
+  gold.use_scheduler(scheduler, "gold", 3);
+  build(gold, until);
+
+  pipeline_system bronze;
+  bronze.use_scheduler(scheduler, "bronze", 1);
+  build(bronze, until);
+
+  gold.start(false);
+  bronze.start(false);
+  gold.explicit_join();
+  bronze.explicit_join();
+
+  // under contention every tenant gets about what its weight entitles it to, how close depends on the
+  // machine, e.g. a tenant idling at startup gives its time away
+  for (const auto &share : scheduler->shares()) {
+    a(std::cout) << share.name << ": " << int(share.share * 100) << "% of the cpu time, fair share "
+                 << int(share.fair_share * 100) << "%" << std::endl;
+  }
+}
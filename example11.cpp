@@ -0,0 +1,56 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+
+#include <iostream>
+
+struct order : public message_type {
+  size_t id;
+  double amount;
+  order(size_t id, double amount) : id(id), amount(amount) {}
+};
+
+int main() {
+  pipeline_system system;
+
+  auto orders = system.create_queue("orders", 100);
+  auto valid = system.create_queue("valid", 100);
+  auto small = system.create_queue("small", 100);
+  auto large = system.create_queue("large", 10);
+
+  size_t i = 0;
+  system.spawn_producer(
+      "orders",
+      [&i]() -> std::shared_ptr<order> {
+        if (i == 100000) return nullptr;
+        i++;
+        return std::make_shared<order>(i, double((i * 7919) % 1000) - 100);
+      },
+      orders);
+
+  // refunds are handled elsewhere, they never reach the valid queue
+  system.spawn_filter<order>(
+      "no refunds", [](auto o) { return o->amount > 0; }, orders, valid);
+
+  // large orders get a separate, slower path, only it blocks when that path is full
+  system.spawn_router<order>(
+      "by amount", [](auto o) -> size_t { return o->amount >= 800 ? 1 : 0; }, valid, {small, large});
+
+  size_t small_count = 0, large_count = 0;
+  system.spawn_consumer<order>(
+      "small orders", [&](auto) { small_count++; }, small);
+  system.spawn_consumer<order>(
+      "large orders",
+      [&](auto) {
+        large_count++;
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+      },
+      large);
+
+  system.start();
+  a(std::cout) << "small orders: " << small_count << ", large orders: " << large_count << std::endl;
+}
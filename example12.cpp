@@ -0,0 +1,62 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+
+#include <iostream>
+
+struct click : public message_type {
+  size_t user_id;
+  explicit click(size_t user_id) : user_id(user_id) {}
+};
+
+struct profile : public message_type {
+  size_t user_id;
+  std::string country;
+  profile(size_t user_id, std::string country) : user_id(user_id), country(std::move(country)) {}
+};
+
+int main() {
+  pipeline_system system;
+
+  auto clicks = system.create_queue("clicks", 100);
+  auto profiles = system.create_queue("profiles", 100);
+
+  // a few users account for most of the clicks
+  size_t i = 0;
+  system.spawn_producer(
+      "clicks",
+      [&i]() -> std::shared_ptr<click> {
+        if (i == 20000) return nullptr;
+        i++;
+        return std::make_shared<click>((i * i) % 300);
+      },
+      clicks);
+
+  // stands in for a slow lookup in some remote database
+  auto lookup = [](std::shared_ptr<click> c) {
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+    return std::make_shared<profile>(c->user_id, c->user_id % 2 ? "NL" : "BE");
+  };
+  auto user_id = [](std::shared_ptr<click> c) { return c->user_id; };
+
+  // four workers looking up profiles, each profile is only looked up once as long as it stays cached
+  auto cache = system.spawn_cached_transformer<click>("lookup 0", user_id, lookup, 256, clicks, profiles);
+  for (int worker = 1; worker < 4; worker++) {
+    system.spawn_cached_transformer<click>("lookup " + std::to_string(worker), user_id, lookup, cache, clicks, profiles);
+  }
+
+  size_t dutch = 0;
+  system.spawn_consumer<profile>(
+      "count", [&](auto p) { dutch += p->country == "NL"; }, profiles);
+
+  system.start();
+  for (const auto &[name, c] : system.get_stats().get_caches()) {
+    a(std::cout) << name << ": " << c.hits << " hits, " << c.coalesced << " coalesced, " << c.misses << " misses, "
+                 << c.evictions << " evictions" << std::endl;
+  }
+  a(std::cout) << "clicks from NL: " << dutch << std::endl;
+}
@@ -0,0 +1,75 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+
+using clock_type = std::chrono::steady_clock;
+
+struct request : public message_type {
+  size_t id;
+  clock_type::time_point created;
+  request(size_t id, clock_type::time_point created) : id(id), created(created) {}
+};
+
+// returns the 99th percentile of the time from producing a request to consuming its response
+double run(bool hedging) {
+  pipeline_system system;
+
+  auto requests = system.create_queue("requests", 10);
+  auto responses = system.create_queue("responses", 10);
+  if (hedging) {
+    system.set_hedging(requests);
+  }
+
+  size_t i = 0;
+  system.spawn_producer(
+      "requests",
+      [&i]() -> std::shared_ptr<request> {
+        if (i == 2000) return nullptr;
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+        return std::make_shared<request>(i++, clock_type::now());
+      },
+      requests);
+
+  // one in fifty calls hits a slow path, the same request is fast again on a second try
+  for (int worker = 0; worker < 4; worker++) {
+    system.spawn_transformer<request>(
+        "worker " + std::to_string(worker),
+        [](auto r) {
+          thread_local std::mt19937 gen(std::random_device{}());
+          const bool slow = std::uniform_int_distribution<>(0, 49)(gen) == 0;
+          std::this_thread::sleep_for(slow ? std::chrono::milliseconds(20) : std::chrono::microseconds(200));
+          return std::make_shared<request>(r->id, r->created);
+        },
+        requests,
+        responses);
+  }
+
+  std::vector<double> latencies;
+  system.spawn_consumer<request>(
+      "latency",
+      [&](auto r) {
+        latencies.push_back(std::chrono::duration<double, std::milli>(clock_type::now() - r->created).count());
+      },
+      responses);
+
+  system.start();
+  for (const auto &[name, h] : system.get_stats().get_hedging()) {
+    a(std::cout) << name << ": " << h.hedged << " of " << h.messages << " hedged, " << h.wins << " won" << std::endl;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  return latencies.empty() ? 0 : latencies[latencies.size() * 99 / 100];
+}
+
+int main() {
+  const auto without = run(false);
+  const auto with = run(true);
+  a(std::cout) << "p99 latency without hedging: " << without << " ms, with hedging: " << with << " ms" << std::endl;
+}
@@ -0,0 +1,53 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+
+#include <iostream>
+
+struct event : public message_type {
+  size_t id;
+  explicit event(size_t id) : id(id) {}
+};
+
+int main() {
+  pipeline_system system;
+
+  auto events = system.create_queue("events", 1000);
+  auto enriched = system.create_queue("enriched", 1000);
+
+  // an endless stream, as in a service
+  size_t i = 0;
+  system.spawn_producer(
+      "events", [&i]() { return std::make_shared<event>(i++); }, events);
+  system.spawn_transformer<event>(
+      "enrich", [](auto e) { return e; }, events, enriched);
+  size_t stored = 0;
+  system.spawn_consumer<event>(
+      "store",
+      [&stored](auto) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        stored++;
+      },
+      enriched);
+
+  system.start(false);
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+
+  // e.g. on SIGTERM during a rolling restart: finish what we can in 50 ms, then leave
+  const auto report = system.shutdown(std::chrono::milliseconds(50));
+  system.explicit_join();
+  a(std::cout) << "produced " << i << ", stored " << stored << ", " << report.in_flight
+               << " in flight at shutdown, " << report.undelivered << " undelivered, "
+               << (report.drained ? "drained" : "cancelled") << " after "
+               << std::chrono::duration_cast<std::chrono::milliseconds>(report.elapsed).count() << " ms" << std::endl;
+  for (const auto &[name, left] : report.undelivered_per_queue) {
+    a(std::cout) << "  " << name << ": " << left << std::endl;
+  }
+  for (const auto &name : report.stuck_nodes) {
+    a(std::cout) << "  stuck: " << name << std::endl;
+  }
+}
@@ -0,0 +1,91 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+
+#include <array>
+#include <iostream>
+#include <map>
+
+struct request : public message_type {
+  std::string tenant;
+  std::string body;
+  request(std::string tenant, std::string body) : tenant(std::move(tenant)), body(std::move(body)) {}
+  size_t byte_size() const override {
+    return body.size();
+  }
+};
+
+// payload sizes in power-of-two buckets, and requests per tenant, of everything pushed into a queue
+struct payload_metrics {
+  std::array<std::atomic<size_t>, 16> size_buckets{};
+  std::mutex mut;
+  std::map<std::string, size_t> per_tenant;
+
+  void on_push(const queue &, const message_type &m) {
+    size_t bucket = 0;
+    for (auto size = m.byte_size(); size > 1 && bucket + 1 < size_buckets.size(); size /= 2) bucket++;
+    size_buckets[bucket]++;
+    std::scoped_lock lock(mut);
+    per_tenant[static_cast<const request &>(m).tenant]++;
+  }
+};
+
+// how long the nodes reading a queue take per message, and how long they wait for one
+struct latency_metrics {
+  std::atomic<int64_t> process_ns = 0;
+  std::atomic<int64_t> wait_ns = 0;
+  std::atomic<size_t> processed = 0;
+
+  void on_process_end(const node &, const message_type &, std::chrono::steady_clock::duration took) {
+    process_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(took).count();
+    processed++;
+  }
+  void on_wait_end(const queue &, wait_kind kind, std::chrono::steady_clock::duration waited) {
+    if (kind == wait_kind::not_empty) wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count();
+  }
+};
+
+int main() {
+  pipeline_system system;
+
+  auto requests = system.create_queue("requests", 100);
+  auto handled = system.create_queue("handled", 100);
+
+  auto payloads = std::make_shared<payload_metrics>();
+  auto latency = std::make_shared<latency_metrics>();
+  system.instrument(requests, payloads);
+  system.instrument(requests, latency);
+
+  const std::array<std::string, 3> tenants = {"acme", "globex", "initech"};
+  size_t i = 0;
+  system.spawn_producer(
+      "requests",
+      [&]() -> std::shared_ptr<request> {
+        if (i == 10000) return nullptr;
+        i++;
+        return std::make_shared<request>(tenants[i % 7 % tenants.size()], std::string((i * 7919) % 5000, 'x'));
+      },
+      requests);
+  system.spawn_transformer<request>(
+      "handle", [](auto r) { return r; }, requests, handled);
+  system.spawn_consumer<request>(
+      "respond", [](auto) {}, handled);
+
+  system.start();
+
+  a(std::cout) << "payload sizes:" << "\n";
+  for (size_t bucket = 0; bucket < payloads->size_buckets.size(); bucket++) {
+    if (const auto n = payloads->size_buckets[bucket].load()) {
+      a(std::cout) << "  < " << (size_t(2) << bucket) << " bytes: " << n << "\n";
+    }
+  }
+  for (const auto &[tenant, n] : payloads->per_tenant) {
+    a(std::cout) << tenant << ": " << n << " requests" << "\n";
+  }
+  a(std::cout) << "handle: " << latency->process_ns / std::max(latency->processed.load(), size_t(1))
+               << " ns per request, waited " << latency->wait_ns / 1000 << " us for requests" << std::endl;
+}
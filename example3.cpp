@@ -10,6 +10,8 @@ struct simple_msg : public message_type {};
 
 int main() {
   pipeline_system system(true); /* visualization is enabled in the constructor */
+  system.perf_counters_enabled = true; /* per-node counters are shown below the graph */
+  system.enable_flight_recorder().dump_on_signal("flight.json"); /* kill -USR1 <pid> for the last 5 minutes */
 
   auto jobs = system.create_queue("jobs", 10);
   auto processed = system.create_queue("processed", 10);
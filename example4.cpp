@@ -6,9 +6,24 @@
 
 #include "piper.h"
 
-int main() {
+int main(int argc, char *argv[]) {
   pipeline_system system(true); /* visualization is enabled in the constructor */
 
+  /* replays real traffic recorded with example7 as fast as possible */
+  if (argc > 1) {
+    auto q1 = system.create_queue(100);
+    auto q2 = system.create_queue(100);
+    if (!system.spawn_replayer("replay", argv[1], deserialize_buffer_message, replay_options{0}, q1)) {
+      return 1;
+    }
+    for (int i = 0; i < 4; i++)
+      system.spawn_transformer<message_type>(
+          [](auto job) -> auto { return job; }, q1, q2);
+    system.spawn_consumer<message_type>([](auto) {}, q2);
+    system.start();
+    return 0;
+  }
+
   /* around 900.000 FPS on my laptop */
   if (false) {
     auto q1 = system.create_queue(100);
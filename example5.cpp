@@ -0,0 +1,52 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+
+#include <iostream>
+
+struct seq : public message_type {
+  size_t i;
+  explicit seq(size_t i) : i(i) {}
+};
+
+struct seq_multiplied : public message_type {
+  size_t i;
+  explicit seq_multiplied(size_t i) : i(i) {}
+};
+
+int main() {
+  pipeline_system system;
+
+  auto numbers = system.create_queue("numbers", 10);
+  auto results = system.create_queue("results", 10);
+
+  // multiply number by ten with three workers
+  auto multiply_by_ten = [](auto seq) -> auto { return std::make_shared<seq_multiplied>(seq->i * 10); };
+  for (int i = 0; i < 3; i++) {
+    system.spawn_transformer<seq>(
+        "worker " + std::to_string(i), multiply_by_ten, numbers, results, transform_type::same_pool);
+  }
+
+  // every job sums its results
+  auto jobs = system.spawn_job_runner<seq_multiplied, size_t>(
+      "sum", [](size_t &sum, auto result) { sum += result->i; }, numbers, results);
+
+  system.start(false);
+
+  // the same threads are reused for every job
+  for (size_t job = 1; job <= 5; job++) {
+    auto i = std::make_shared<size_t>(1);
+    auto result = jobs->submit([i, max = job * 10]() -> std::shared_ptr<message_type> {
+      if (*i <= max) return std::make_shared<seq>((*i)++);
+      return nullptr;
+    });
+    a(std::cout) << "sum of 1.." << job * 10 << " multiplied by ten: " << result.get() << std::endl;
+  }
+
+  jobs->close();
+  system.explicit_join();
+}
@@ -0,0 +1,70 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+
+#include <iostream>
+#include <sstream>
+
+struct document : public message_type {
+  std::string text;
+  explicit document(std::string text) : text(std::move(text)) {}
+};
+
+struct line : public message_type {
+  std::string text;
+  explicit line(std::string text) : text(std::move(text)) {}
+};
+
+int main() {
+  pipeline_system system;
+
+  auto documents = system.create_queue("documents", 10);
+  auto lines = system.create_queue("lines", 100);
+  auto batches = system.create_queue("batches", 10);
+
+  // produce a few documents, slowly, so the time based flush kicks in
+  size_t i = 0;
+  system.spawn_producer(
+      "producer",
+      [&i]() -> std::shared_ptr<document> {
+        if (i++ == 10) return nullptr;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        std::stringstream ss;
+        for (size_t j = 0; j < 25; j++) ss << (j % 2 ? "odd " : "even ") << i << "." << j << std::endl;
+        return std::make_shared<document>(ss.str());
+      },
+      documents);
+
+  // explode every document into its lines
+  system.spawn_flat_map<document>(
+      "split lines",
+      [](auto doc) {
+        std::vector<std::shared_ptr<line>> ret;
+        std::istringstream ss(doc->text);
+        for (std::string s; std::getline(ss, s);) ret.push_back(std::make_shared<line>(s));
+        return ret;
+      },
+      documents,
+      lines);
+
+  // batch the lines per key, at most 40 lines per batch, or whatever arrived within 50 milliseconds
+  system.spawn_keyed_window<line>(
+      "batch lines",
+      [](const line &l) { return l.text.substr(0, l.text.find(' ')); },
+      window_options{40, std::chrono::milliseconds(50)},
+      lines,
+      batches);
+
+  system.spawn_consumer<keyed_batch<line, std::string>>(
+      "writer",
+      [](auto batch) {
+        a(std::cout) << "writing batch of " << batch->items.size() << " " << batch->key << " lines" << std::endl;
+      },
+      batches);
+
+  system.start();
+}
@@ -0,0 +1,61 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+
+#include <cctype>
+#include <iostream>
+
+int main(int argc, char *argv[]) {
+  if (argc != 3 && argc != 4) {
+    std::cerr << "usage: " << argv[0] << " <input file> <output file> [recording]" << std::endl;
+    return 1;
+  }
+
+  pipeline_system system;
+  // however long the lines are, at most 16M of them wait in the queues
+  system.set_memory_budget(16 * 1024 * 1024);
+
+  auto lines = system.create_queue("lines", 1000, 4 * 1024 * 1024);
+  auto upper = system.create_queue("upper", 1000);
+
+  // every line is a slice of the memory mapped input file
+  if (!system.spawn_file_source("read", argv[1], file_source_options{}, lines)) {
+    std::cerr << "cannot open " << argv[1] << std::endl;
+    return 1;
+  }
+
+  // optionally record the lines with their timing, example4 can replay them
+  if (argc == 4 && !system.record(lines, argv[3], serialize_buffer_message)) {
+    std::cerr << "cannot create " << argv[3] << std::endl;
+    return 1;
+  }
+
+  // only the transformed copy is allocated, from a slab shared by many lines
+  slab_allocator allocator;
+  system.spawn_transformer<buffer_message>(
+      "to upper",
+      [&](auto in) {
+        auto out = allocator.allocate(in->payload.size());
+        for (size_t i = 0; i < in->payload.size(); i++) {
+          out.mutable_data()[i] = char(std::toupper(static_cast<unsigned char>(in->payload.data()[i])));
+        }
+        return std::make_shared<buffer_message>(out);
+      },
+      lines,
+      upper);
+
+  // restore the newlines and write in large batches
+  file_sink_options options;
+  options.delimiter = '\n';
+  if (!system.spawn_file_sink("write", argv[2], options, upper)) {
+    std::cerr << "cannot open " << argv[2] << std::endl;
+    return 1;
+  }
+
+  system.start();
+  return 0;
+}
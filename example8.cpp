@@ -0,0 +1,59 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+
+#include <iostream>
+
+struct number : public message_type {
+  uint64_t value;
+  explicit number(uint64_t value) : value(value) {}
+};
+
+int main() {
+  pipeline_system system(true);
+
+  const size_t replicas = std::max(std::thread::hardware_concurrency(), 1u);
+  std::vector<std::shared_ptr<queue>> inputs;
+  // one cache line per replica for its part of the checksum
+  struct alignas(64) partial {
+    uint64_t sum = 0;
+  };
+  std::vector<partial> sums(replicas);
+
+  // the same graph once per core, the replicas share nothing
+  system.replicate(replicas, [&](size_t r) {
+    auto in = system.create_queue("numbers", 100);
+    auto out = system.create_queue("hashes", 100);
+    inputs.push_back(in);
+    system.spawn_transformer<number>(
+        "hash",
+        [](auto n) {
+          uint64_t h = n->value;
+          for (int i = 0; i < 1000; i++) h = (h ^ (h >> 31)) * 0x9e3779b97f4a7c15ULL;
+          return std::make_shared<number>(h);
+        },
+        in,
+        out);
+    system.spawn_consumer<number>(
+        "sum", [&sums, r](auto n) { sums[r].sum += n->value; }, out);
+  });
+
+  // one front-end distributes the input over the replicas round-robin
+  uint64_t i = 0;
+  system.spawn_sharded_producer(
+      "generate",
+      [&i]() -> std::shared_ptr<number> {
+        if (i == 2000000) return nullptr;
+        return std::make_shared<number>(i++);
+      },
+      inputs);
+
+  system.start();
+  uint64_t checksum = 0;
+  for (const auto &p : sums) checksum += p.sum;
+  a(std::cout) << "checksum: " << checksum << std::endl;
+}
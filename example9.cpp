@@ -0,0 +1,77 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+
+#include <iostream>
+#include <random>
+
+// the points of example.cpp, a whole batch per message
+using random_xy = column_batch<double, double>;
+
+constexpr size_t batch_size = 4096;
+constexpr size_t batches = 2000;
+
+struct in_circle : public message_type {
+  size_t inside;
+  size_t total;
+  in_circle(size_t inside, size_t total) : inside(inside), total(total) {}
+};
+
+int main() {
+  pipeline_system system;
+
+  auto points = system.create_queue("points", 5);
+  auto results = system.create_queue("results", 5);
+
+  a(std::cout) << "using " << simd::to_string(simd::active()) << " kernels" << std::endl;
+
+  // produce batches of random X,Y coordinates.
+  system.spawn_producer(
+      "random",
+      []() -> std::shared_ptr<random_xy> {
+        static std::mt19937 gen;
+        static size_t produced = 0;
+        if (produced++ == batches) return nullptr;
+        auto batch = std::make_shared<random_xy>(batch_size);
+        for (size_t i = 0; i < batch_size; i++) {
+          auto x = (gen() / double(gen.max()));
+          auto y = (gen() / double(gen.max()));
+          batch->push_back(x, y);
+        }
+        return batch;
+      },
+      points);
+
+  // check which points are within the circle, a column at a time
+  system.spawn_transformer<random_xy>(
+      "in circle",
+      [](auto batch) -> auto {
+        auto &x = batch->template get<0>();
+        auto &y = batch->template get<1>();
+        // the batch is ours, so center the points in place
+        simd::add(x.data(), -0.5, x.data(), x.size());
+        simd::add(y.data(), -0.5, y.data(), y.size());
+        column<double> dist;
+        simd::sum_of_squares(x, y, dist);
+        return std::make_shared<in_circle>(simd::count_less_equal(dist.data(), 0.25, dist.size()), dist.size());
+      },
+      points,
+      results);
+
+  // estimate pi based on results
+  size_t nom = 0, denom = 0;
+  system.spawn_consumer<in_circle>(
+      "estimate",
+      [&](auto result) {
+        nom += result->inside;
+        denom += result->total;
+      },
+      results);
+
+  system.start();
+  a(std::cout) << "Estimated pi: " << 4 * (nom / (double)denom) << " from " << denom << " points" << std::endl;
+}
@@ -0,0 +1,51 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+class pipeline_system;
+
+/**
+ * Uses the cumulative busy / blocked-on-input / blocked-on-output time of each node to find the stage
+ * that limits the throughput of the pipeline.
+ *
+ * Nodes that pop from the same input queue with the same consumer id form a pool and are treated as
+ * replicas of one stage, as are producers writing to the same queues.
+ */
+class bottleneck_analyzer {
+public:
+  struct stage {
+    std::string name;
+    std::vector<std::string> replicas;
+    size_t messages = 0;
+    double utilization = 0;     // fraction of accounted time spent working
+    double starved = 0;         // fraction of accounted time blocked on input
+    double back_pressured = 0;  // fraction of accounted time blocked on output
+    double capacity = 0;        // messages per second when never blocked, summed over replicas
+  };
+
+  struct report {
+    std::vector<stage> stages;
+    std::optional<size_t> bottleneck;
+    double throughput = 0;      // messages per second the bottleneck stage can sustain
+    double estimated_gain = 0;  // relative throughput gain from adding one replica to the bottleneck
+
+    std::string summary() const;
+    std::string to_string() const;
+  };
+
+private:
+  pipeline_system &system;
+
+public:
+  explicit bottleneck_analyzer(pipeline_system &sys);
+
+  report analyze() const;
+};
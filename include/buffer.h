@@ -0,0 +1,92 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "message_type.hpp"
+
+/**
+ * A contiguous block of memory, either allocated on the heap or a memory mapped file.
+ * Slabs are reference counted by the slices pointing into them, and released with the last slice.
+ */
+struct slab {
+  char *data = nullptr;
+  size_t size = 0;
+  virtual ~slab() = default;
+};
+
+/**
+ * A read-only view on (part of) a slab. Copying or slicing a buffer_slice never copies the bytes,
+ * so stages can pass sub-views of a large payload downstream for free.
+ */
+class buffer_slice {
+private:
+  std::shared_ptr<slab> owner_;
+  char *data_ = nullptr;
+  size_t size_ = 0;
+
+public:
+  buffer_slice() = default;
+  buffer_slice(std::shared_ptr<slab> owner, char *data, size_t size);
+
+  const char *data() const {
+    return data_;
+  }
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+  std::string_view view() const {
+    return {data_, size_};
+  }
+
+  // writable access, only meant for whoever allocated the slice and before passing it on
+  char *mutable_data() {
+    return data_;
+  }
+
+  // sub-view of [offset, offset + length), clamped to the bounds of this slice
+  buffer_slice slice(size_t offset, size_t length = std::string_view::npos) const;
+
+  static buffer_slice allocate(size_t size);
+  static buffer_slice copy_of(std::string_view bytes);
+  static std::optional<buffer_slice> map_file(const std::string &filename);
+};
+
+/**
+ * Hands out writable slices carved from large slabs, so many small payloads share one allocation.
+ * A slab is freed once all slices into it are gone. Not thread-safe, use one allocator per node.
+ */
+class slab_allocator {
+private:
+  size_t slab_size_;
+  std::shared_ptr<slab> current_;
+  size_t used_ = 0;
+
+public:
+  explicit slab_allocator(size_t slab_size = 1024 * 1024);
+
+  buffer_slice allocate(size_t size);
+};
+
+/**
+ * Message carrying a byte payload.
+ */
+struct buffer_message : public message_type {
+  buffer_slice payload;
+  explicit buffer_message(buffer_slice payload) : payload(std::move(payload)) {}
+
+  size_t byte_size() const override {
+    return payload.size();
+  }
+};
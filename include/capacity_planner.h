@@ -0,0 +1,109 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+class pipeline_system;
+
+struct simulation_options {
+  double duration = 10;  // simulated seconds
+  double warmup = 1;     // simulated seconds that are not measured
+  uint64_t seed = 1;
+};
+
+/**
+ * Discrete-event simulation of a pipeline graph, to predict throughput, queue depths and latency for
+ * other replica counts and queue sizes without running them.
+ *
+ * The model is taken from a pipeline_system: stages are grouped the same way as in the
+ * bottleneck_analyzer, and their service times and fan-out are derived from the stats of a previous
+ * run. All of it can be edited before simulating, for example to plug in measured samples.
+ */
+class capacity_planner {
+public:
+  enum class distribution {
+    constant,
+    exponential,
+    // draws from service_model::samples
+    empirical,
+  };
+
+  struct service_model {
+    distribution dist = distribution::exponential;
+    double mean = 0;  // seconds per message per replica, stages without a measurement are assumed to take 1us
+    std::vector<double> samples;
+  };
+
+  struct output_model {
+    std::string queue;
+    // fraction of the stage's messages routed to this queue
+    double share = 1;
+  };
+
+  struct stage_model {
+    std::string name;
+    std::optional<std::string> input;
+    // more than one for routers and sharded producers, every message goes to one of them
+    std::vector<output_model> outputs;
+    size_t replicas = 1;
+    service_model service;
+    // messages emitted per message processed, e.g. above 1 for flat-map stages and below 1 for windows
+    double fan_out = 1;
+  };
+
+  struct queue_model {
+    std::string name;
+    size_t max_items = 10;
+  };
+
+  // overrides of the model, keyed by stage and queue name
+  struct scenario {
+    std::map<std::string, size_t> replicas;
+    std::map<std::string, size_t> max_items;
+  };
+
+  struct stage_result {
+    std::string name;
+    size_t replicas;
+    double utilization;  // fraction of time the replicas were serving
+  };
+
+  struct queue_result {
+    std::string name;
+    size_t max_items;
+    double mean_depth;
+    size_t max_depth;
+  };
+
+  struct result {
+    double throughput = 0;  // messages per second leaving the pipeline
+    double latency_p50 = 0;
+    double latency_p95 = 0;
+    double latency_p99 = 0;
+    std::vector<stage_result> stages;
+    std::vector<queue_result> queues;
+
+    std::string to_string() const;
+  };
+
+  std::vector<stage_model> stages;
+  std::vector<queue_model> queues;
+
+  capacity_planner() = default;
+  explicit capacity_planner(pipeline_system &sys);
+
+  result simulate(const scenario &s = {}, const simulation_options &o = {}) const;
+  std::vector<result> compare(const std::vector<scenario> &scenarios, const simulation_options &o = {}) const;
+  // adds replicas to the busiest stage one at a time, until the target throughput is predicted or
+  // extra_replicas have been added, producers are left alone as they define the offered load
+  scenario plan(double target_throughput, size_t extra_replicas, const simulation_options &o = {}) const;
+};
@@ -0,0 +1,130 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "message_type.hpp"
+
+/**
+ * Allocates on cache line boundaries, so columns can be loaded with aligned SIMD instructions.
+ */
+template <typename T, size_t ALIGN = 64>
+struct aligned_allocator {
+  using value_type = T;
+  template <typename U>
+  struct rebind {
+    using other = aligned_allocator<U, ALIGN>;
+  };
+
+  aligned_allocator() = default;
+  template <typename U>
+  aligned_allocator(const aligned_allocator<U, ALIGN> &) {}
+
+  T *allocate(size_t n) {
+    const auto bytes = (n * sizeof(T) + ALIGN - 1) / ALIGN * ALIGN;
+    if (auto *p = std::aligned_alloc(ALIGN, bytes)) {
+      return static_cast<T *>(p);
+    }
+    throw std::bad_alloc();
+  }
+  void deallocate(T *p, size_t) {
+    std::free(p);
+  }
+
+  template <typename U>
+  bool operator==(const aligned_allocator<U, ALIGN> &) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const aligned_allocator<U, ALIGN> &) const {
+    return false;
+  }
+};
+
+template <typename T>
+using column = std::vector<T, aligned_allocator<T>>;
+
+// indices of the rows that passed a filter, in ascending order
+using selection = column<uint32_t>;
+
+/**
+ * Message carrying many records at once, stored as one contiguous column per field (struct of arrays).
+ * Stages process whole columns instead of paying the queue overhead per record, and the loops over
+ * the columns can use SIMD, see simd_kernels.h.
+ */
+template <typename... Ts>
+struct column_batch : public message_type {
+  std::tuple<column<Ts>...> columns;
+
+  column_batch() = default;
+  explicit column_batch(size_t capacity) {
+    reserve(capacity);
+  }
+
+  template <size_t I>
+  auto &get() {
+    return std::get<I>(columns);
+  }
+  template <size_t I>
+  const auto &get() const {
+    return std::get<I>(columns);
+  }
+
+  size_t size() const {
+    return std::get<0>(columns).size();
+  }
+  bool empty() const {
+    return size() == 0;
+  }
+
+  void reserve(size_t n) {
+    std::apply([n](auto &...c) { (c.reserve(n), ...); }, columns);
+  }
+  void resize(size_t n) {
+    std::apply([n](auto &...c) { (c.resize(n), ...); }, columns);
+  }
+  void push_back(const Ts &...values) {
+    push_back_impl(std::index_sequence_for<Ts...>{}, values...);
+  }
+
+  // new batch with only the selected rows
+  std::shared_ptr<column_batch> gather(const selection &rows) const {
+    auto ret = std::make_shared<column_batch>();
+    gather_impl(std::index_sequence_for<Ts...>{}, rows, *ret);
+    return ret;
+  }
+
+  size_t byte_size() const override {
+    return size() * (sizeof(Ts) + ...);
+  }
+
+private:
+  template <size_t... I>
+  void push_back_impl(std::index_sequence<I...>, const Ts &...values) {
+    (std::get<I>(columns).push_back(values), ...);
+  }
+
+  template <size_t... I>
+  void gather_impl(std::index_sequence<I...>, const selection &rows, column_batch &out) const {
+    (gather_column(std::get<I>(columns), rows, std::get<I>(out.columns)), ...);
+  }
+
+  template <typename T>
+  static void gather_column(const column<T> &in, const selection &rows, column<T> &out) {
+    out.resize(rows.size());
+    for (size_t i = 0; i < rows.size(); i++) {
+      out[i] = in[rows[i]];
+    }
+  }
+};
@@ -0,0 +1,93 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct tenant_share {
+  std::string name;
+  double weight;
+  // time the tenant's nodes held a slot, and waited for one
+  int64_t cpu_ns;
+  int64_t wait_ns;
+  // of the slot time used by all tenants so far
+  double share;
+  // what the weight entitles to when all tenants are busy
+  double fair_share;
+};
+
+/**
+ * Process-wide budget of threads shared by several pipeline_systems, for example one per tenant.
+ *
+ * Nodes keep their own threads, but a node only runs while it holds one of the `threads` slots. It
+ * gives the slot back when it is about to block on a queue, or after a quantum when others are
+ * waiting. Free slots go to the waiting tenant that used the least slot time relative to its weight,
+ * so under contention tenants get CPU time in proportion to their weights, and a tenant that was
+ * idle doesn't get to catch up on the time it didn't use.
+ */
+class fair_scheduler {
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct tenant {
+    std::string name;
+    double weight;
+    // slot time divided by weight, the tenant with the lowest value goes first
+    double vtime = 0;
+    size_t waiting = 0;
+    size_t running = 0;
+    // the tenant's own waiters are served first come, first served, so a node giving back its slot
+    // queues up behind the tenant's nodes that were already waiting
+    uint64_t next_ticket = 0;
+    uint64_t serving = 0;
+    // set by cancel(), the tenant's nodes no longer wait for slots
+    bool cancelled = false;
+    int64_t cpu_ns = 0;
+    int64_t wait_ns = 0;
+    clock::time_point last_release;
+  };
+
+private:
+  mutable std::mutex mut_;
+  std::condition_variable cv_;
+  std::vector<std::shared_ptr<tenant>> tenants_;
+  size_t free_slots_;
+  std::atomic<size_t> waiting_ = 0;
+  std::chrono::microseconds quantum_;
+
+  tenant *next_unprotected() const;
+  void release_unprotected(tenant &t, clock::duration held);
+  bool wait_unprotected(std::unique_lock<std::mutex> &lock, tenant &t);
+  tenant_share share_unprotected(const tenant &t) const;
+
+public:
+  explicit fair_scheduler(size_t threads, std::chrono::microseconds quantum = std::chrono::milliseconds(2));
+
+  std::shared_ptr<tenant> add_tenant(std::string name, double weight = 1);
+  void remove_tenant(const std::shared_ptr<tenant> &t);
+
+  // blocks until the tenant gets a slot, false without one when the tenant was cancelled
+  bool acquire(tenant &t);
+  void release(tenant &t, clock::duration held);
+  // release() and acquire() in one go, competing for the slot with the tenants already waiting
+  bool yield(tenant &t, clock::duration held);
+  // wakes the tenant's waiting nodes without a slot, for good, e.g. when its system shuts down
+  void cancel(tenant &t);
+  // true when a slot held this long should go back, because others are waiting for one
+  bool should_yield(clock::duration held) const {
+    return held >= quantum_ && waiting_.load(std::memory_order_relaxed) > 0;
+  }
+
+  std::vector<tenant_share> shares() const;
+  tenant_share share_of(const tenant &t) const;
+};
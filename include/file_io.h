@@ -0,0 +1,111 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "buffer.h"
+
+enum class split_mode {
+  // one message per line, without the newline
+  lines,
+  // one message per record, records are separated by file_source_options::delimiter
+  records,
+  // messages of file_source_options::chunk_size bytes, the last one may be shorter, 0 doesn't open
+  fixed_size,
+};
+
+struct file_source_options {
+  split_mode mode = split_mode::lines;
+  char delimiter = '\n';
+  size_t chunk_size = 64 * 1024;
+  // map the entire file, otherwise read it in blocks of readahead bytes
+  bool use_mmap = true;
+  size_t readahead = 4 * 1024 * 1024;
+};
+
+struct file_sink_options {
+  // collect this many bytes before writing them in one go
+  size_t batch_bytes = 1024 * 1024;
+  // write whatever was collected after this long, also if no more input arrives
+  std::chrono::milliseconds linger{100};
+  // number of batches that may be in flight
+  size_t queue_depth = 16;
+  bool use_io_uring = true;
+  bool append = false;
+  // written after every message, for example to restore the newlines stripped by split_mode::lines
+  std::optional<char> delimiter;
+};
+
+/**
+ * Splits a file into buffer_message slices, either from a memory mapping or from large blocks read
+ * ahead. Messages point into the mapping or blocks, so no bytes are copied per message.
+ */
+class file_source {
+private:
+  file_source_options options;
+  int fd = -1;
+  buffer_slice block;
+  size_t pos = 0;
+  bool eof = false;
+  bool is_open_ = false;
+  size_t bytes_read_ = 0;
+
+  bool refill();
+
+public:
+  file_source(const std::string &filename, file_source_options options);
+  ~file_source();
+  file_source(const file_source &) = delete;
+  file_source &operator=(const file_source &) = delete;
+
+  bool is_open() const;
+  std::shared_ptr<buffer_message> next();
+  size_t bytes_read() const;
+};
+
+class file_writer;
+
+/**
+ * Collects buffer_message payloads into batches and writes them asynchronously, using io_uring
+ * when the kernel supports it and a pwrite thread otherwise. After a failed write the sink stops
+ * writing and drops whatever it gets, see errors().
+ */
+class file_sink {
+public:
+  using clock = std::chrono::steady_clock;
+
+private:
+  file_sink_options options;
+  int fd = -1;
+  std::unique_ptr<file_writer> writer;
+  std::vector<buffer_slice> batch;
+  size_t batched_bytes = 0;
+  size_t offset = 0;
+  clock::time_point first_batched;
+
+public:
+  file_sink(const std::string &filename, file_sink_options options);
+  ~file_sink();
+  file_sink(const file_sink &) = delete;
+  file_sink &operator=(const file_sink &) = delete;
+
+  bool is_open() const;
+  bool uses_io_uring() const;
+  void write(const buffer_message &msg);
+  // writes the current batch if it is due at the given time, time_point::max() also waits until it's on disk
+  void flush(clock::time_point now);
+  std::optional<clock::time_point> deadline() const;
+  // bytes that actually made it to the file, completed writes only
+  size_t bytes_written() const;
+  // failed writes
+  size_t errors() const;
+};
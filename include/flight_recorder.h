@@ -0,0 +1,88 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class stats;
+
+struct flight_recorder_options {
+  // 100 Hz
+  std::chrono::milliseconds interval{10};
+  // how far back a dump goes, the ring holds history / interval frames
+  std::chrono::seconds history{300};
+};
+
+/**
+ * Samples the counters, queue sizes and sleep states of all nodes and queues at a fixed rate into a
+ * ring of preallocated frames, so the moments before a stall can still be looked at afterwards.
+ *
+ * Sampling happens on the recorder's own thread under the stats lock, once the ring has wrapped
+ * around it no longer allocates. Dumps are JSON, one frame per line, with the names listed once.
+ */
+class flight_recorder {
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct entry {
+    uint32_t name;
+    uint8_t flags;
+    int32_t size;
+    uint64_t counter;
+    uint64_t bytes;
+  };
+  enum entry_flags : uint8_t {
+    is_storage = 1,
+    active = 2,
+    sleeping_until_not_full = 4,
+    sleeping_until_not_empty = 8,
+  };
+  struct frame {
+    int64_t time_ns;
+    uint64_t in_flight_bytes;
+    std::vector<entry> entries;
+  };
+
+private:
+  const stats &stats_;
+  flight_recorder_options options_;
+  clock::time_point epoch_ = clock::now();
+  std::mutex mut_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+  std::vector<std::string> names_;
+  std::unordered_map<std::string, uint32_t> name_index_;
+  std::vector<frame> frames_;
+  uint64_t head_ = 0;
+  // the file dumped to when the dump signal arrives, empty if not listening for it
+  std::string signal_filename_;
+  uint64_t signals_seen_ = 0;
+  std::thread runner_;
+
+  void run();
+  void sample_unprotected();
+  void dump_unprotected(std::ostream &os, std::chrono::milliseconds last);
+
+public:
+  flight_recorder(const stats &s, flight_recorder_options options);
+  ~flight_recorder();
+
+  // the frames of the last `last` milliseconds, everything in the ring by default
+  void dump(std::ostream &os, std::chrono::milliseconds last = std::chrono::milliseconds::max());
+  bool dump(const std::string &filename, std::chrono::milliseconds last = std::chrono::milliseconds::max());
+  // dumps the whole ring to the file every time the process receives the signal, e.g. `kill -USR1 <pid>`
+  void dump_on_signal(std::string filename, int signal = SIGUSR1);
+};
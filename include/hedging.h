@@ -0,0 +1,90 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "message_type.hpp"
+
+struct hedging_options {
+  // messages taking longer than this percentile of the recent transform times get a duplicate
+  double percentile = 0.95;
+  // lower bound for the threshold, so idle workers don't poll for microsecond stragglers
+  std::chrono::microseconds min_delay = std::chrono::milliseconds(1);
+  // transform times measured before the threshold is trusted, no hedging until then
+  size_t warmup = 100;
+};
+
+struct hedging_stats {
+  size_t messages = 0;
+  // duplicates started by idle workers, and how many of them finished first
+  size_t hedged = 0;
+  size_t wins = 0;
+  int64_t threshold_ns = 0;
+
+  double hedge_ratio() const {
+    return messages ? double(hedged) / messages : 0;
+  }
+};
+
+/**
+ * Shared by the same_pool transformers of one input queue, see pipeline_system::set_hedging().
+ *
+ * Workers register every message they transform. A worker that runs out of input duplicates the
+ * oldest message that is still being transformed for longer than the threshold, a percentile of
+ * the recent transform times. Whichever attempt finishes first gets its result pushed, the other
+ * result is dropped, so the transform function has to be idempotent and must not modify its input.
+ */
+class hedge_group {
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct attempt {
+    std::shared_ptr<message_type> message;
+    clock::time_point started;
+    bool hedged = false;
+    bool finished = false;
+  };
+
+private:
+  static constexpr size_t sample_count = 1024;
+  // how many new samples before the percentile is computed again
+  static constexpr size_t resample_every = 64;
+
+  hedging_options options_;
+  mutable std::mutex mut_;
+  // oldest first
+  std::list<std::shared_ptr<attempt>> in_flight_;
+  std::vector<int64_t> samples_;
+  size_t samples_taken_ = 0;
+  std::atomic<int64_t> threshold_ns_ = 0;
+  std::atomic<size_t> messages_ = 0;
+  std::atomic<size_t> hedged_ = 0;
+  std::atomic<size_t> wins_ = 0;
+
+  void add_sample_unprotected(int64_t ns);
+
+public:
+  explicit hedge_group(hedging_options options);
+
+  std::shared_ptr<attempt> begin(std::shared_ptr<message_type> message);
+  // an attempt still running for longer than the threshold, if any, started again by the caller
+  std::shared_ptr<attempt> hedge(clock::time_point now);
+  // true for the attempt that finished first, only its result should be pushed
+  bool finish(attempt &a, clock::time_point started, bool is_hedge);
+  // when an idle worker should look for stragglers again, nothing before the threshold is known or
+  // while every message being transformed is hedged already
+  std::optional<clock::time_point> next_check(clock::time_point now) const;
+
+  hedging_stats read() const;
+};
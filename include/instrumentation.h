@@ -0,0 +1,149 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "message_type.hpp"
+
+// build with -DPIPER_INSTRUMENTATION=0 (cmake -DNO_INSTRUMENTATION=1) to compile every hook away
+#ifndef PIPER_INSTRUMENTATION
+#define PIPER_INSTRUMENTATION 1
+#endif
+
+constexpr bool instrumentation_enabled = PIPER_INSTRUMENTATION;
+
+class queue;
+class node;
+
+enum class wait_kind {
+  // a consumer waiting for the queue to get items
+  not_empty,
+  // a provider waiting for the queue to get room
+  not_full,
+};
+
+namespace detail {
+template <typename, template <typename...> class OP, typename... ARGS>
+struct detector : std::false_type {};
+template <template <typename...> class OP, typename... ARGS>
+struct detector<std::void_t<OP<ARGS...>>, OP, ARGS...> : std::true_type {};
+template <template <typename...> class OP, typename... ARGS>
+constexpr bool is_detected_v = detector<void, OP, ARGS...>::value;
+
+using duration_t = std::chrono::steady_clock::duration;
+template <typename P>
+using on_push_t = decltype(std::declval<P &>().on_push(std::declval<const queue &>(),
+                                                       std::declval<const message_type &>()));
+template <typename P>
+using on_pop_t = decltype(std::declval<P &>().on_pop(std::declval<const queue &>(),
+                                                     std::declval<const message_type &>()));
+template <typename P>
+using on_wait_begin_t = decltype(std::declval<P &>().on_wait_begin(std::declval<const queue &>(), wait_kind{}));
+template <typename P>
+using on_wait_end_t = decltype(std::declval<P &>().on_wait_end(std::declval<const queue &>(),
+                                                               wait_kind{},
+                                                               std::declval<duration_t>()));
+template <typename P>
+using on_process_begin_t = decltype(std::declval<P &>().on_process_begin(std::declval<const node &>(),
+                                                                         std::declval<const message_type &>()));
+template <typename P>
+using on_process_end_t = decltype(std::declval<P &>().on_process_end(std::declval<const node &>(),
+                                                                     std::declval<const message_type &>(),
+                                                                     std::declval<duration_t>()));
+}  // namespace detail
+
+/**
+ * The observers of one queue, see pipeline_system::instrument().
+ *
+ * An observer is any class with one or more of these member functions:
+ *
+ *   on_push(const queue &, const message_type &)
+ *   on_pop(const queue &, const message_type &)
+ *   on_wait_begin(const queue &, wait_kind)
+ *   on_wait_end(const queue &, wait_kind, std::chrono::steady_clock::duration)
+ *   on_process_begin(const node &, const message_type &)
+ *   on_process_end(const node &, const message_type &, std::chrono::steady_clock::duration)
+ *
+ * The process hooks are for the nodes consuming from the queue. Only the hooks an observer has are
+ * registered, so a queue without observers for a hook pays one check of an empty vector, and a queue
+ * without observers one pointer check. Hooks are called from the node threads, outside the queue's
+ * lock, so observers shared between nodes or queues have to be thread-safe.
+ */
+class instrumentation_hooks {
+public:
+  using clock = std::chrono::steady_clock;
+
+private:
+  std::vector<std::function<void(const queue &, const message_type &)>> push_;
+  std::vector<std::function<void(const queue &, const message_type &)>> pop_;
+  std::vector<std::function<void(const queue &, wait_kind)>> wait_begin_;
+  std::vector<std::function<void(const queue &, wait_kind, clock::duration)>> wait_end_;
+  std::vector<std::function<void(const node &, const message_type &)>> process_begin_;
+  std::vector<std::function<void(const node &, const message_type &, clock::duration)>> process_end_;
+
+public:
+  template <typename P>
+  void add(std::shared_ptr<P> observer) {
+    using namespace detail;
+    static_assert(is_detected_v<on_push_t, P> || is_detected_v<on_pop_t, P> || is_detected_v<on_wait_begin_t, P> ||
+                      is_detected_v<on_wait_end_t, P> || is_detected_v<on_process_begin_t, P> ||
+                      is_detected_v<on_process_end_t, P>,
+                  "an observer needs at least one of the on_push/on_pop/on_wait_*/on_process_* hooks");
+    if constexpr (is_detected_v<on_push_t, P>) {
+      push_.emplace_back([observer](const queue &q, const message_type &m) { observer->on_push(q, m); });
+    }
+    if constexpr (is_detected_v<on_pop_t, P>) {
+      pop_.emplace_back([observer](const queue &q, const message_type &m) { observer->on_pop(q, m); });
+    }
+    if constexpr (is_detected_v<on_wait_begin_t, P>) {
+      wait_begin_.emplace_back([observer](const queue &q, wait_kind kind) { observer->on_wait_begin(q, kind); });
+    }
+    if constexpr (is_detected_v<on_wait_end_t, P>) {
+      wait_end_.emplace_back(
+          [observer](const queue &q, wait_kind kind, clock::duration waited) { observer->on_wait_end(q, kind, waited); });
+    }
+    if constexpr (is_detected_v<on_process_begin_t, P>) {
+      process_begin_.emplace_back([observer](const node &n, const message_type &m) { observer->on_process_begin(n, m); });
+    }
+    if constexpr (is_detected_v<on_process_end_t, P>) {
+      process_end_.emplace_back([observer](const node &n, const message_type &m, clock::duration took) {
+        observer->on_process_end(n, m, took);
+      });
+    }
+  }
+
+  void on_push(const queue &q, const message_type &m) const {
+    for (const auto &f : push_) f(q, m);
+  }
+  void on_pop(const queue &q, const message_type &m) const {
+    for (const auto &f : pop_) f(q, m);
+  }
+  bool observes_waits() const {
+    return !wait_begin_.empty() || !wait_end_.empty();
+  }
+  void on_wait_begin(const queue &q, wait_kind kind) const {
+    for (const auto &f : wait_begin_) f(q, kind);
+  }
+  void on_wait_end(const queue &q, wait_kind kind, clock::duration waited) const {
+    for (const auto &f : wait_end_) f(q, kind, waited);
+  }
+  bool observes_processing() const {
+    return !process_begin_.empty() || !process_end_.empty();
+  }
+  void on_process_begin(const node &n, const message_type &m) const {
+    for (const auto &f : process_begin_) f(n, m);
+  }
+  void on_process_end(const node &n, const message_type &m, clock::duration took) const {
+    for (const auto &f : process_end_) f(n, m, took);
+  }
+};
@@ -0,0 +1,149 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+#include "job_marker.hpp"
+#include "message_type.hpp"
+#include "node.h"
+#include "queue.h"
+
+/**
+ * Feeds discrete jobs through a running pipeline without tearing it down in between.
+ *
+ * A job is a producer function that returns nullptr when the job has no more input. Instead of
+ * deactivating the pipeline that nullptr makes the source push a job_marker, and once the marker
+ * reaches the sink the folded RESULT is handed to the future returned by submit().
+ * Jobs are run one after the other, the threads stay warm between jobs. Call close() to let the
+ * pipeline drain and deactivate as usual.
+ */
+template <typename RESULT>
+class job_dispatcher {
+public:
+  using producer_fun_t = std::function<std::shared_ptr<message_type>()>;
+
+private:
+  struct job {
+    uint64_t id;
+    producer_fun_t fun;
+    std::promise<RESULT> result;
+  };
+  std::mutex mut;
+  std::condition_variable cv;
+  std::deque<job> pending;
+  std::optional<job> in_flight;
+  uint64_t next_id = 1;
+  bool closed = false;
+  // set by pipeline_system::shutdown()
+  bool cancelled = false;
+
+  // only touched by the source node
+  producer_fun_t producer;
+  uint64_t producing_id = 0;
+  bool producing = false;
+
+  // only touched by the sink node
+  RESULT accumulator{};
+
+public:
+  std::future<RESULT> submit(producer_fun_t fun);
+  void close();
+  // stops taking jobs, the pending ones are dropped and their futures get a broken_promise error
+  void cancel();
+
+  // the source gives its fair_scheduler slot back while waiting for a job
+  std::shared_ptr<message_type> produce(queue &output, node *source = nullptr);
+  RESULT &result();
+  void complete(const job_marker &marker);
+};
+
+template <typename RESULT>
+std::future<RESULT> job_dispatcher<RESULT>::submit(producer_fun_t fun) {
+  std::future<RESULT> ret;
+  {
+    std::scoped_lock lock(mut);
+    auto &j = pending.emplace_back(job{next_id++, std::move(fun), std::promise<RESULT>()});
+    ret = j.result.get_future();
+  }
+  cv.notify_all();
+  return ret;
+}
+
+template <typename RESULT>
+void job_dispatcher<RESULT>::close() {
+  {
+    std::scoped_lock lock(mut);
+    closed = true;
+  }
+  cv.notify_all();
+}
+
+template <typename RESULT>
+void job_dispatcher<RESULT>::cancel() {
+  {
+    std::scoped_lock lock(mut);
+    cancelled = true;
+    pending.clear();
+  }
+  cv.notify_all();
+}
+
+template <typename RESULT>
+std::shared_ptr<message_type> job_dispatcher<RESULT>::produce(queue &output, node *source) {
+  while (true) {
+    if (producing) {
+      if (auto msg = producer()) {
+        return msg;
+      }
+      producing = false;
+      output.push_marker(std::make_shared<job_marker>(producing_id));
+    }
+    std::unique_lock lock(mut);
+    const auto ready = [this]() { return cancelled || (!in_flight && (!pending.empty() || closed)); };
+    if (!ready() && source && source->holding_slot()) {
+      lock.unlock();
+      source->release_slot();
+      lock.lock();
+    }
+    cv.wait(lock, ready);
+    if (cancelled || pending.empty()) {
+      // closed or cancelled, end of the stream deactivates the pipeline
+      return nullptr;
+    }
+    in_flight.emplace(std::move(pending.front()));
+    pending.pop_front();
+    producer = in_flight->fun;
+    producing_id = in_flight->id;
+    producing = true;
+  }
+}
+
+template <typename RESULT>
+RESULT &job_dispatcher<RESULT>::result() {
+  return accumulator;
+}
+
+template <typename RESULT>
+void job_dispatcher<RESULT>::complete(const job_marker &marker) {
+  {
+    std::scoped_lock lock(mut);
+    if (!in_flight || in_flight->id != marker.job) {
+      return;
+    }
+    in_flight->result.set_value(std::move(accumulator));
+    accumulator = RESULT{};
+    in_flight.reset();
+  }
+  cv.notify_all();
+}
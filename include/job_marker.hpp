@@ -0,0 +1,21 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "message_type.hpp"
+
+/**
+ * Marks the end of a job. Markers flow through the queues next to regular messages, but they do not
+ * occupy a slot and are delivered to every consumer node, including each worker of a pool.
+ * A queue only releases a marker downstream once all of its providers have pushed it.
+ */
+struct job_marker : public message_type {
+  uint64_t job;
+  explicit job_marker(uint64_t job) : job(job) {}
+};
@@ -6,6 +6,18 @@
 
 #pragma once
 
+#include <cstddef>
+
 struct message_type {
   virtual ~message_type() = default;
+
+  // lane to use in queues with priority lanes, 0 is the most urgent
+  virtual size_t priority() const {
+    return 0;
+  }
+
+  // bytes held by this message, used for the per-queue memory accounting
+  virtual size_t byte_size() const {
+    return 0;
+  }
 };
@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <functional>
 #include <memory>
@@ -13,9 +15,12 @@
 #include <optional>
 #include <string>
 #include <thread>
+#include <vector>
 
+#include "job_marker.hpp"
 #include "message_type.hpp"
 #include "queue.h"
+#include "tracer.h"
 #include "transform_type.hpp"
 
 class pipeline_system;
@@ -25,44 +30,104 @@ private:
   pipeline_system &system;
   int64_t id_ = 0;
   std::string name_;
+  // set for the nodes of a replicate()d graph, before the thread starts
+  std::optional<int> cpu_;
   std::thread runner;
   bool active_ = true;
+  // set when the thread leaves run()
+  std::atomic<bool> stopped_ = false;
   std::shared_ptr<queue> input_queue;
   std::shared_ptr<queue> output_queue;
+  std::vector<std::shared_ptr<queue>> routed_queues;
   std::optional<transform_type> transform_type_;
+  std::shared_ptr<tracer::ring> trace_ring_;
+  // only for same_pool transformers of a queue with hedging
+  std::shared_ptr<hedge_group> hedge_;
+  using clock = std::chrono::steady_clock;
+  // only with a fair_scheduler, whether this node holds one of its slots and since when
+  bool holding_slot_ = false;
+  clock::time_point slot_acquired_;
   using message_t = std::shared_ptr<message_type>;
   using produce_fun_t = std::function<message_t()>;
   using transform_fun_t = std::function<message_t(message_t)>;
   using consume_fun_t = std::function<void(message_t)>;
+  using marker_fun_t = std::function<void(std::shared_ptr<job_marker>)>;
+  using flat_map_fun_t = std::function<std::vector<message_t>(message_t)>;
+  using flush_fun_t = std::function<std::vector<message_t>(clock::time_point)>;
+  using deadline_fun_t = std::function<std::optional<clock::time_point>()>;
+  using route_fun_t = std::function<size_t(const message_t &)>;
   produce_fun_t produce_fun = []() -> message_t { return nullptr; };
   transform_fun_t transform_fun = [](message_t a) -> message_t { return a; };
   consume_fun_t consume_fun = [](const message_t &) {};
+  marker_fun_t marker_fun;
+  flat_map_fun_t flat_map_fun;
+  flush_fun_t flush_fun;
+  deadline_fun_t deadline_fun;
+  route_fun_t route_fun;
 
 public:
   explicit node(pipeline_system &sys);
   explicit node(const std::string &name, pipeline_system &sys);
 
-  std::string name();
+  std::string name() const;
+  int64_t id() const;
   bool active();
+  bool stopped() const;
   std::optional<transform_type> get_transform_type();
+  std::shared_ptr<queue> get_input_queue();
+  std::shared_ptr<queue> get_output_queue();
+  const std::vector<std::shared_ptr<queue>> &get_routed_queues();
+  // every queue the node pushes to, more than one for routers and sharded producers
+  std::vector<std::shared_ptr<queue>> get_output_queues();
+  std::optional<int> cpu();
 
   void set_id(int64_t id);
   void init();
   void set_input_queue(std::shared_ptr<queue> ptr);
   void set_output_queue(std::shared_ptr<queue> ptr);
   void set_transform_type(transform_type tt);
+  // creates the thread, which runs once the system is started
+  void start();
   void run();
 
   void set_produce_function(produce_fun_t fun);
   void set_transform_function(transform_fun_t fun);
   void set_consume_function(consume_fun_t fun);
+  void set_marker_function(marker_fun_t fun);
+  void set_flat_map_function(flat_map_fun_t fun);
+  void set_flush_function(flush_fun_t fun, deadline_fun_t deadline);
+  // sends every message to outputs[fun(message) % outputs.size()], the first output doubles as output queue
+  void set_route_function(route_fun_t fun, std::vector<std::shared_ptr<queue>> outputs);
 
   std::shared_ptr<message_type> produce();
   std::shared_ptr<message_type> transform(std::shared_ptr<message_type> item);
+  // returns nullptr when a duplicate of the attempt finished first, hedges are counted by the hedge_group only
+  std::shared_ptr<message_type> transform(hedge_group::attempt &attempt, bool is_hedge);
+  // transform() without counting the message
+  std::shared_ptr<message_type> transform_uncounted(std::shared_ptr<message_type> item);
+  // duplicates the stragglers of the other workers while this one has no input
+  void hedge_stragglers();
   void consume(std::shared_ptr<message_type> item);
+  std::vector<std::shared_ptr<message_type>> flat_map(std::shared_ptr<message_type> item);
+  void flush(clock::time_point now);
+  void push(std::shared_ptr<message_type> item);
+  void push_all(std::vector<std::shared_ptr<message_type>> items);
+  void route(std::shared_ptr<message_type> item);
+  void handle_markers();
 
   void sleep_until_items_available();
-  void sleep_until_not_full();
+  void sleep_until_not_full(std::optional<size_t> lane = std::nullopt);
+  void sleep_until_not_full(queue &q, std::optional<size_t> lane);
+  void sleep_until_within_memory_budget();
+  bool holding_slot() const;
+  void acquire_slot();
+  // the queues call this when the node is about to block on them
+  void release_slot();
+  // hands the slot to a waiting node after a quantum
+  void yield_slot();
+  void trace(trace_kind kind, clock::time_point begin, clock::time_point end);
+  // the input queue's observers of processing, nullptr when there are none
+  const instrumentation_hooks *process_hooks() const;
   void deactivate();
   void join();
 };
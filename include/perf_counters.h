@@ -0,0 +1,53 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+struct perf_sample {
+  // false when the PMU is unavailable, e.g. in most VMs, leaving cycles, instructions and cache misses at 0
+  bool hardware = false;
+  uint64_t cycles = 0;
+  uint64_t instructions = 0;
+  uint64_t cache_misses = 0;
+  // software events, always available where perf events are
+  uint64_t task_clock_ns = 0;
+  uint64_t context_switches = 0;
+  uint64_t page_faults = 0;
+
+  double ipc() const {
+    return cycles ? double(instructions) / cycles : 0;
+  }
+
+  perf_sample &operator+=(const perf_sample &other);
+  perf_sample operator-(const perf_sample &other) const;
+};
+
+/**
+ * Counters of one thread, opened with perf_event_open. The counters keep counting the thread until it
+ * exits and can be read from any thread, also after it exited.
+ */
+class perf_counters {
+private:
+  enum event { cycles, instructions, cache_misses, task_clock, context_switches, page_faults, event_count };
+  std::array<int, event_count> fds_;
+
+  perf_counters();
+
+public:
+  perf_counters(const perf_counters &) = delete;
+  perf_counters &operator=(const perf_counters &) = delete;
+  ~perf_counters();
+
+  // nullptr when not even the software events can be opened, e.g. due to perf_event_paranoid
+  static std::shared_ptr<perf_counters> open_for_current_thread();
+
+  bool hardware() const;
+  perf_sample read() const;
+};
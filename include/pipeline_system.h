@@ -6,16 +6,47 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <variant>
 #include <vector>
 
+#include "fair_scheduler.h"
+#include "file_io.h"
+#include "flight_recorder.h"
+#include "job_dispatcher.h"
 #include "node.h"
 #include "queue.h"
+#include "recording.h"
+#include "result_cache.h"
 #include "stats.h"
+#include "tracer.h"
 #include "transform_type.hpp"
+#include "window.h"
+
+// the key type a cached transformer's key function returns for its input type
+template <typename IN, typename KF>
+using cache_key_t = std::decay_t<std::invoke_result_t<KF, std::shared_ptr<IN>>>;
+
+// what pipeline_system::shutdown() managed to deliver
+struct shutdown_report {
+  // true when every node finished before the deadline, nothing had to be cancelled
+  bool drained = false;
+  std::chrono::nanoseconds elapsed{0};
+  // messages in the queues when the shutdown began, and those left behind in them
+  size_t in_flight = 0;
+  size_t undelivered = 0;
+  std::map<std::string, size_t> undelivered_per_queue;
+  // nodes still busy in their function after the grace period, shutdown() returned without them
+  std::vector<std::string> stuck_nodes;
+};
 
 class pipeline_system {
 public:
@@ -25,28 +56,88 @@ public:
   std::condition_variable cv;
   std::mutex mut;
   bool started = false;
-  bool is_active = true;
+  std::atomic<bool> is_active = true;
+  // set by shutdown(), producers stop producing and the rest of the pipeline runs dry
+  std::atomic<bool> draining = false;
+  // nodes that left node::run(), protected by mut
+  size_t stopped_nodes = 0;
+  // called by shutdown() when draining begins, for nodes blocked outside the queues, e.g. job runner sources
+  std::vector<std::function<void()>> shutdown_hooks;
   stats stats_;
+  tracer tracer_;
+  // set with enable_flight_recorder(), destroyed before stats_ which it samples
+  std::unique_ptr<flight_recorder> flight_recorder_;
   std::thread runner;
   std::vector<std::shared_ptr<node>> spawned;
+  // set while replicate() builds a replica, for naming and pinning its nodes and queues
+  std::optional<size_t> building_replica;
+  bool pin_replicas = false;
+  // set before start() to count cycles, instructions, cache misses, context switches and page faults per node
+  bool perf_counters_enabled = false;
+  // total bytes the queues may hold before producers are throttled, 0 for no budget, see set_memory_budget()
+  std::atomic<size_t> memory_budget = 0;
+  std::mutex memory_mut;
+  std::condition_variable memory_cv;
+  // set with use_scheduler(), the nodes then only run while holding one of the scheduler's slots
+  std::shared_ptr<fair_scheduler> scheduler;
+  std::shared_ptr<fair_scheduler::tenant> tenant;
 
   explicit pipeline_system();
   explicit pipeline_system(bool visualization_enabled);
+  // shuts down right away when nodes are still running, then joins all node threads, which blocks for
+  // as long as a node is stuck in its function, see shutdown_report::stuck_nodes
   ~pipeline_system();
 
   void run();
   void link(std::shared_ptr<queue>);
   void link(node *);
   void sleep();
+  // starts the node threads, which initialize in parallel, nodes have to be spawned before this
   void start(bool auto_join_threads = true);
   void explicit_join();
   bool active() const;
+  // stops the producers and lets the other nodes process what is in flight, at the deadline the
+  // nodes still waiting on queues are woken up and stop, nodes busy in a function get the grace
+  // period to finish it, those that don't are reported as stuck instead of waited for
+  shutdown_report shutdown(std::chrono::steady_clock::time_point deadline,
+                           std::chrono::milliseconds grace = std::chrono::milliseconds(100));
+  shutdown_report shutdown(std::chrono::milliseconds timeout,
+                           std::chrono::milliseconds grace = std::chrono::milliseconds(100));
+  void node_stopped();
+
+  // runs the builder n times, each replica's nodes and queues get a " #i" suffix and optionally one core
+  void replicate(size_t n, const std::function<void(size_t)> &builder, bool pin_threads = true);
+  std::string replica_name(const std::string &name) const;
+  std::optional<int> replica_cpu() const;
+
+  // shares the scheduler's threads with the other systems using it, in proportion to the weight, call before start()
+  void use_scheduler(std::shared_ptr<fair_scheduler> shared, std::string tenant_name, double weight = 1);
+
+  // producers wait before producing while the queues together hold more bytes than the budget
+  void set_memory_budget(size_t bytes);
+  void acquire_memory(size_t bytes);
+  void release_memory(size_t bytes);
+  // returns the time it started blocking, or nothing if within budget right away
+  // a waiter holding a fair_scheduler slot gives it back when it blocks
+  std::optional<queue::clock::time_point> sleep_until_within_memory_budget(node *waiter = nullptr);
 
   std::shared_ptr<queue> create_queue(size_t max_items);
   std::shared_ptr<queue> create_queue(const std::string &name, size_t max_items);
+  // full at max_items or once the queued messages hold max_bytes, whichever comes first
+  std::shared_ptr<queue> create_queue(const std::string &name, size_t max_items, size_t max_bytes);
+  std::shared_ptr<queue> create_queue(const std::string &name,
+                                      std::vector<lane_options> lanes,
+                                      lane_policy policy = lane_policy::strict);
+  std::shared_ptr<queue> create_queue(capacity_tuning tuning);
+  std::shared_ptr<queue> create_queue(const std::string &name, capacity_tuning tuning);
 
   template <typename F>
   void spawn_producer(std::string name, F &&fun, std::shared_ptr<queue> output);
+  // one producer feeding several queues, e.g. the inputs of replicas, by default round-robin
+  template <typename F>
+  void spawn_sharded_producer(std::string name, F &&fun, std::vector<std::shared_ptr<queue>> outputs);
+  template <typename F, typename S>
+  void spawn_sharded_producer(std::string name, F &&fun, S &&shard, std::vector<std::shared_ptr<queue>> outputs);
   template <typename IN, typename F>
   void spawn_transformer(std::string name,
                          F &&fun,
@@ -55,6 +146,45 @@ public:
                          std::optional<transform_type> tt = std::nullopt);
   template <typename IN, typename F>
   void spawn_consumer(std::string name, F &&fun, std::shared_ptr<queue> input);
+  template <typename IN, typename F>
+  void spawn_flat_map(std::string name, F &&fun, std::shared_ptr<queue> input, std::shared_ptr<queue> output);
+  // a same_pool transformer that computes fun once per key_fun(message), as long as the result stays
+  // among the capacity most recently used ones, the returned cache can be shared with more workers
+  template <typename IN, typename KF, typename F>
+  std::shared_ptr<result_cache<cache_key_t<IN, KF>>> spawn_cached_transformer(std::string name,
+                                                                            KF &&key_fun,
+                                                                            F &&fun,
+                                                                            size_t capacity,
+                                                                            std::shared_ptr<queue> input,
+                                                                            std::shared_ptr<queue> output);
+  template <typename IN, typename KF, typename F, typename K>
+  void spawn_cached_transformer(std::string name,
+                                KF &&key_fun,
+                                F &&fun,
+                                std::shared_ptr<result_cache<K>> cache,
+                                std::shared_ptr<queue> input,
+                                std::shared_ptr<queue> output);
+  // forwards the messages the predicate accepts, the others never touch the output queue
+  template <typename IN, typename F>
+  void spawn_filter(std::string name,
+                    F &&predicate,
+                    std::shared_ptr<queue> input,
+                    std::shared_ptr<queue> output,
+                    std::optional<transform_type> tt = std::nullopt);
+  // forwards every message to outputs[fun(message) % outputs.size()], blocking only on the chosen output
+  template <typename IN, typename F>
+  void spawn_router(std::string name, F &&fun, std::shared_ptr<queue> input, std::vector<std::shared_ptr<queue>> outputs);
+  template <typename IN>
+  void spawn_window(std::string name,
+                    window_options options,
+                    std::shared_ptr<queue> input,
+                    std::shared_ptr<queue> output);
+  template <typename IN, typename F>
+  void spawn_keyed_window(std::string name,
+                          F &&key_fun,
+                          window_options options,
+                          std::shared_ptr<queue> input,
+                          std::shared_ptr<queue> output);
 
   template <typename F>
   void spawn_producer(F &&fun, std::shared_ptr<queue> output);
@@ -65,8 +195,62 @@ public:
                          std::optional<transform_type> tt = std::nullopt);
   template <typename IN, typename F>
   void spawn_consumer(F &&fun, std::shared_ptr<queue> input);
+  template <typename IN, typename F>
+  void spawn_flat_map(F &&fun, std::shared_ptr<queue> input, std::shared_ptr<queue> output);
+  template <typename IN, typename F>
+  void spawn_filter(F &&predicate,
+                    std::shared_ptr<queue> input,
+                    std::shared_ptr<queue> output,
+                    std::optional<transform_type> tt = std::nullopt);
+  template <typename IN, typename F>
+  void spawn_router(F &&fun, std::shared_ptr<queue> input, std::vector<std::shared_ptr<queue>> outputs);
+  template <typename IN>
+  void spawn_window(window_options options, std::shared_ptr<queue> input, std::shared_ptr<queue> output);
+  template <typename IN, typename F>
+  void spawn_keyed_window(F &&key_fun,
+                          window_options options,
+                          std::shared_ptr<queue> input,
+                          std::shared_ptr<queue> output);
+
+  // both return false when the file cannot be opened, in which case no node is spawned
+  bool spawn_file_source(std::string name,
+                         const std::string &filename,
+                         file_source_options options,
+                         std::shared_ptr<queue> output);
+  bool spawn_file_sink(std::string name,
+                       const std::string &filename,
+                       file_sink_options options,
+                       std::shared_ptr<queue> input);
+
+  // idle same_pool transformers of the queue duplicate messages the others take unusually long for,
+  // the first result is pushed, the other dropped, only for idempotent transforms, call before start()
+  void set_hedging(std::shared_ptr<queue> input, hedging_options options = {});
+
+  // attaches an observer with any of the hooks listed in instrumentation.h to the queue, call before
+  // start(), without PIPER_INSTRUMENTATION this does nothing and the hooks are compiled away
+  template <typename P>
+  void instrument(std::shared_ptr<queue> q, std::shared_ptr<P> observer);
+
+  // records everything pushed into the queue, returns nullptr when the file cannot be created
+  std::shared_ptr<recorder> record(std::shared_ptr<queue> q, const std::string &filename, serialize_fun_t serialize);
+  bool spawn_replayer(std::string name,
+                      const std::string &filename,
+                      deserialize_fun_t deserialize,
+                      replay_options options,
+                      std::shared_ptr<queue> output);
+
+  template <typename IN, typename RESULT, typename F>
+  std::shared_ptr<job_dispatcher<RESULT>> spawn_job_runner(std::string name,
+                                                           F &&fold,
+                                                           std::shared_ptr<queue> input,
+                                                           std::shared_ptr<queue> output);
 
   const stats &get_stats() const;
+  tracer &get_tracer();
+  // starts sampling the stats into a ring right away, returns the recorder to dump it
+  flight_recorder &enable_flight_recorder(flight_recorder_options options = {});
+  // nullptr unless enabled
+  flight_recorder *get_flight_recorder();
 };
 
 // spawn functions
@@ -89,6 +273,37 @@ void pipeline_system::spawn_consumer(F &&fun, std::shared_ptr<queue> input) {
   spawn_consumer<IN>("", fun, input);
 }
 
+template <typename IN, typename F>
+void pipeline_system::spawn_flat_map(F &&fun, std::shared_ptr<queue> input, std::shared_ptr<queue> output) {
+  spawn_flat_map<IN>("", fun, input, output);
+}
+template <typename IN, typename F>
+void pipeline_system::spawn_filter(F &&predicate,
+                                   std::shared_ptr<queue> input,
+                                   std::shared_ptr<queue> output,
+                                   std::optional<transform_type> tt) {
+  spawn_filter<IN>("", predicate, input, output, tt);
+}
+template <typename IN, typename F>
+void pipeline_system::spawn_router(F &&fun, std::shared_ptr<queue> input, std::vector<std::shared_ptr<queue>> outputs) {
+  spawn_router<IN>("", fun, input, outputs);
+}
+
+template <typename IN>
+void pipeline_system::spawn_window(window_options options,
+                                   std::shared_ptr<queue> input,
+                                   std::shared_ptr<queue> output) {
+  spawn_window<IN>("", options, input, output);
+}
+
+template <typename IN, typename F>
+void pipeline_system::spawn_keyed_window(F &&key_fun,
+                                         window_options options,
+                                         std::shared_ptr<queue> input,
+                                         std::shared_ptr<queue> output) {
+  spawn_keyed_window<IN>("", key_fun, options, input, output);
+}
+
 template <typename F>
 void pipeline_system::spawn_producer(std::string name, F &&fun, std::shared_ptr<queue> output) {
   auto n = std::make_shared<node>(name, *this);
@@ -97,6 +312,23 @@ void pipeline_system::spawn_producer(std::string name, F &&fun, std::shared_ptr<
   spawned.push_back(n);
 }
 
+template <typename F>
+void pipeline_system::spawn_sharded_producer(std::string name, F &&fun, std::vector<std::shared_ptr<queue>> outputs) {
+  size_t next = 0;
+  spawn_sharded_producer(name, fun, [next](const auto &) mutable { return next++; }, outputs);
+}
+
+template <typename F, typename S>
+void pipeline_system::spawn_sharded_producer(std::string name,
+                                             F &&fun,
+                                             S &&shard,
+                                             std::vector<std::shared_ptr<queue>> outputs) {
+  auto n = std::make_shared<node>(name, *this);
+  n->set_produce_function(fun);
+  n->set_route_function(shard, std::move(outputs));
+  spawned.push_back(n);
+}
+
 template <typename IN, typename F>
 void pipeline_system::spawn_transformer(std::string name,
                                         F &&fun,
@@ -105,7 +337,7 @@ void pipeline_system::spawn_transformer(std::string name,
                                         std::optional<transform_type> tt) {
   auto n = std::make_shared<node>(name, *this);
   static int uid = 1;
-  if (tt || *tt == transform_type::same_pool) {
+  if (!tt || *tt == transform_type::same_pool) {
     n->set_id(0);
   } else {
     n->set_id(uid++);
@@ -140,3 +372,145 @@ void pipeline_system::spawn_consumer(std::string name, F &&fun, std::shared_ptr<
   n->set_input_queue(input);
   spawned.push_back(n);
 }
+
+template <typename IN, typename F>
+void pipeline_system::spawn_flat_map(std::string name,
+                                     F &&fun,
+                                     std::shared_ptr<queue> input,
+                                     std::shared_ptr<queue> output) {
+  auto n = std::make_shared<node>(name, *this);
+
+  auto wrapper_fun = [=](std::shared_ptr<message_type> in) -> std::vector<std::shared_ptr<message_type>> {
+    auto out = fun(std::dynamic_pointer_cast<IN>(in));
+    return {std::make_move_iterator(out.begin()), std::make_move_iterator(out.end())};
+  };
+
+  n->set_flat_map_function(wrapper_fun);
+  n->set_input_queue(input);
+  n->set_output_queue(output);
+  spawned.push_back(n);
+}
+
+template <typename IN, typename F>
+void pipeline_system::spawn_filter(std::string name,
+                                   F &&predicate,
+                                   std::shared_ptr<queue> input,
+                                   std::shared_ptr<queue> output,
+                                   std::optional<transform_type> tt) {
+  // returning nothing drops the message, node::push() doesn't forward it
+  spawn_transformer<IN>(
+      name,
+      [=](std::shared_ptr<IN> in) -> std::shared_ptr<message_type> { return predicate(in) ? in : nullptr; },
+      input,
+      output,
+      tt);
+}
+
+template <typename IN, typename KF, typename F>
+std::shared_ptr<result_cache<cache_key_t<IN, KF>>> pipeline_system::spawn_cached_transformer(
+    std::string name,
+    KF &&key_fun,
+    F &&fun,
+    size_t capacity,
+    std::shared_ptr<queue> input,
+    std::shared_ptr<queue> output) {
+  auto cache = std::make_shared<result_cache<cache_key_t<IN, KF>>>(capacity);
+  spawn_cached_transformer<IN>(name, key_fun, fun, cache, input, output);
+  return cache;
+}
+
+template <typename IN, typename KF, typename F, typename K>
+void pipeline_system::spawn_cached_transformer(std::string name,
+                                               KF &&key_fun,
+                                               F &&fun,
+                                               std::shared_ptr<result_cache<K>> cache,
+                                               std::shared_ptr<queue> input,
+                                               std::shared_ptr<queue> output) {
+  stats_.set_cache(replica_name(name), cache->counters());
+  spawn_transformer<IN>(
+      name,
+      [=](std::shared_ptr<IN> in) -> std::shared_ptr<message_type> {
+        return cache->get_or_compute(key_fun(in), [&]() -> std::shared_ptr<message_type> { return fun(in); });
+      },
+      input,
+      output,
+      transform_type::same_pool);
+}
+
+template <typename P>
+void pipeline_system::instrument(std::shared_ptr<queue> q, std::shared_ptr<P> observer) {
+  if constexpr (instrumentation_enabled) {
+    if (!q->instrumentation) {
+      q->instrumentation = std::make_shared<instrumentation_hooks>();
+    }
+    q->instrumentation->add(std::move(observer));
+  }
+}
+
+template <typename IN, typename F>
+void pipeline_system::spawn_router(std::string name,
+                                   F &&fun,
+                                   std::shared_ptr<queue> input,
+                                   std::vector<std::shared_ptr<queue>> outputs) {
+  auto n = std::make_shared<node>(name, *this);
+  auto wrapper_fun = [=](const std::shared_ptr<message_type> &in) -> size_t {
+    return fun(std::dynamic_pointer_cast<IN>(in));
+  };
+  // the default transform function passes messages on as they are
+  n->set_input_queue(input);
+  n->set_route_function(wrapper_fun, std::move(outputs));
+  spawned.push_back(n);
+}
+
+template <typename IN>
+void pipeline_system::spawn_window(std::string name,
+                                   window_options options,
+                                   std::shared_ptr<queue> input,
+                                   std::shared_ptr<queue> output) {
+  spawn_keyed_window<IN>(
+      name, [](const IN &) { return std::monostate{}; }, options, input, output);
+}
+
+template <typename IN, typename F>
+void pipeline_system::spawn_keyed_window(std::string name,
+                                         F &&key_fun,
+                                         window_options options,
+                                         std::shared_ptr<queue> input,
+                                         std::shared_ptr<queue> output) {
+  using K = std::decay_t<decltype(key_fun(std::declval<const IN &>()))>;
+  auto n = std::make_shared<node>(name, *this);
+  auto state = std::make_shared<window_state<IN, K>>(options, key_fun);
+
+  n->set_flat_map_function([=](std::shared_ptr<message_type> in) {
+    return state->add(std::dynamic_pointer_cast<IN>(in));
+  });
+  n->set_flush_function([=](auto now) { return state->flush(now); }, [=]() { return state->deadline(); });
+  n->set_input_queue(input);
+  n->set_output_queue(output);
+  spawned.push_back(n);
+}
+
+template <typename IN, typename RESULT, typename F>
+std::shared_ptr<job_dispatcher<RESULT>> pipeline_system::spawn_job_runner(std::string name,
+                                                                          F &&fold,
+                                                                          std::shared_ptr<queue> input,
+                                                                          std::shared_ptr<queue> output) {
+  auto dispatcher = std::make_shared<job_dispatcher<RESULT>>();
+
+  auto source = std::make_shared<node>(name + " source", *this);
+  source->set_produce_function(
+      [dispatcher, q = input.get(), n = source.get()]() { return dispatcher->produce(*q, n); });
+  source->set_output_queue(input);
+  spawned.push_back(source);
+  shutdown_hooks.push_back([dispatcher]() { dispatcher->cancel(); });
+
+  auto sink = std::make_shared<node>(name + " sink", *this);
+  sink->set_consume_function([=](std::shared_ptr<message_type> in) {
+    return fold(dispatcher->result(), std::dynamic_pointer_cast<IN>(in));
+  });
+  sink->set_marker_function([dispatcher](std::shared_ptr<job_marker> marker) { dispatcher->complete(*marker); });
+  sink->set_input_queue(output);
+  spawned.push_back(sink);
+
+  return dispatcher;
+}
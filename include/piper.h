@@ -6,8 +6,24 @@
 
 #pragma once
 
+#include "bottleneck_analyzer.h"
+#include "buffer.h"
+#include "capacity_planner.h"
+#include "column_batch.h"
+#include "fair_scheduler.h"
+#include "file_io.h"
+#include "flight_recorder.h"
+#include "hedging.h"
+#include "instrumentation.h"
+#include "job_dispatcher.h"
 #include "message_type.hpp"
 #include "node.h"
+#include "perf_counters.h"
 #include "pipeline_system.h"
 #include "queue.h"
+#include "recording.h"
+#include "result_cache.h"
+#include "simd_kernels.h"
+#include "tracer.h"
 #include "util/a.hpp"
+#include "window.h"
@@ -5,46 +5,144 @@
  */
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <set>
 #include <vector>
 
+#include "hedging.h"
+#include "instrumentation.h"
+#include "job_marker.hpp"
 #include "message_type.hpp"
 
 class pipeline_system;
 class node;
+class recorder;
+
+struct lane_options {
+  size_t max_items = 10;
+  // share of the pops under lane_policy::weighted_fair
+  size_t weight = 1;
+};
+
+/**
+ * Bounds for a queue that adjusts its own capacity. Producers blocking on a full queue grow it,
+ * items waiting longer than the target latency on average shrink it, and so does a queue that
+ * never fills up, to give the memory back.
+ */
+// the queue raises min_items to at least 1 and max_items to at least min_items
+struct capacity_tuning {
+  size_t min_items = 1;
+  size_t max_items = 10000;
+  std::chrono::microseconds target_latency = std::chrono::milliseconds(10);
+  // how often the capacity is reconsidered
+  std::chrono::milliseconds interval{100};
+};
+
+enum class lane_policy {
+  // always serve the lowest lane index (highest priority) that has items
+  strict,
+  // serve lanes in proportion to their weight (smooth weighted round-robin)
+  weighted_fair,
+};
 
 class queue {
 public:
+  using clock = std::chrono::steady_clock;
+  struct item {
+    std::set<int> consumers;
+    std::shared_ptr<message_type> value;
+    clock::time_point pushed;
+    size_t bytes;
+  };
+  struct lane {
+    std::deque<item> items;
+    size_t max_items;
+    size_t weight;
+    int64_t current_weight = 0;
+  };
+
   std::condition_variable cv;
-  std::vector<std::pair<std::set<int>, std::shared_ptr<message_type>>> items;
+  std::vector<lane> lanes;
+  size_t total_items = 0;
+  size_t total_bytes = 0;
+  lane_policy policy = lane_policy::strict;
   std::map<int, size_t> consumer_items_available;
   std::mutex items_mut;
   std::string name;
   pipeline_system &system;
   size_t max_items = 10;
+  // 0 for no limit, otherwise the queue is also full once its messages hold this many bytes
+  size_t max_bytes = 0;
   bool active = true;
   bool terminating = false;
   std::set<int> consumer_ids = {0};
   std::vector<node *> consumer_ptrs;
   std::vector<node *> provider_ptrs;
+  std::map<uint64_t, size_t> marker_arrivals;
+  std::map<node *, std::deque<std::shared_ptr<job_marker>>> pending_markers;
+  // lets pop_marker() skip locking in pipelines that don't use jobs
+  std::atomic<size_t> markers_pending = 0;
+  // set before the system starts to record everything pushed into this queue
+  std::shared_ptr<recorder> recording;
+  // set before the system starts to let its same_pool transformers duplicate each other's stragglers
+  std::shared_ptr<hedge_group> hedging;
+  // set before the system starts by pipeline_system::instrument()
+  std::shared_ptr<instrumentation_hooks> instrumentation;
+  // only for queues with an adaptive capacity
+  struct tuning_window {
+    clock::time_point started;
+    int64_t blocked_ns = 0;
+    int64_t starved_ns = 0;
+    int64_t latency_ns = 0;
+    size_t popped = 0;
+    size_t peak_items = 0;
+  };
+  std::optional<capacity_tuning> tuning;
+  tuning_window window;
 
   explicit queue(std::string name, pipeline_system &sys, int max_items);
+  explicit queue(std::string name, pipeline_system &sys, std::vector<lane_options> lanes, lane_policy policy);
+  explicit queue(std::string name, pipeline_system &sys, capacity_tuning tuning);
 
   void set_consumer(node *node_ptr, int id);
   void set_provider(node *node_ptr);
-  void sleep_until_not_full();
-  void sleep_until_items_available(int id);
+  // the sleep functions return the time they started blocking, or nothing if they returned right away
+  // a waiter holding a fair_scheduler slot gives it back when it actually blocks, and has to reacquire it
+  std::optional<clock::time_point> sleep_until_not_full(std::optional<size_t> lane = std::nullopt,
+                                                        node *waiter = nullptr);
+  std::optional<clock::time_point> sleep_until_items_available(int id, node *consumer = nullptr);
+  std::optional<clock::time_point> sleep_until_items_available_until(int id,
+                                                                     node *consumer,
+                                                                     clock::time_point deadline);
+  size_t lane_of(const std::shared_ptr<message_type> &value) const;
   void push(std::shared_ptr<message_type> value);
+  void push(std::shared_ptr<message_type> value, size_t prio);
+  void push_all(std::vector<std::shared_ptr<message_type>> values);
+  void push_marker(std::shared_ptr<job_marker> marker);
   bool is_full();
-  bool is_full_unprotected() const;
+  bool is_full_unprotected(std::optional<size_t> lane = std::nullopt) const;
   bool has_items(int id);
   bool has_items_unprotected(int id);
+  std::optional<std::pair<size_t, std::deque<item>::iterator>> select_unprotected(int id);
+  bool has_marker_unprotected(node *consumer);
   std::shared_ptr<message_type> pop(int id);
+  std::shared_ptr<job_marker> pop_marker(node *consumer);
   void check_terminate();
   void deactivate(std::unique_lock<std::mutex> &lock);
+  // the wait hooks are called without holding the lock, the waits check their condition again afterwards
+  void release_slot_unprotected(std::unique_lock<std::mutex> &lock, node *waiter);
+  void wait_begin_unprotected(std::unique_lock<std::mutex> &lock, wait_kind kind);
+  void wait_end_unprotected(std::unique_lock<std::mutex> &lock, wait_kind kind, clock::time_point begin);
+  // deactivates the queue with items left, waking up everyone waiting on it, see pipeline_system::shutdown()
+  void cancel();
+  void tune_unprotected(clock::time_point now);
   size_t size();
+  size_t bytes();
 };
@@ -0,0 +1,114 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "message_type.hpp"
+
+// appends the bytes of a message to the string
+using serialize_fun_t = std::function<void(const message_type &, std::string &)>;
+// creates a message from its bytes, the slice points into the (memory mapped) recording
+using deserialize_fun_t = std::function<std::shared_ptr<message_type>(const buffer_slice &)>;
+
+// codec for buffer_message, replayed payloads are slices of the recording itself
+void serialize_buffer_message(const message_type &msg, std::string &out);
+std::shared_ptr<message_type> deserialize_buffer_message(const buffer_slice &bytes);
+
+/**
+ * Writes the messages pushed into a queue to a file, together with the time between them.
+ * A recording consists of a short header followed by one record per message: the nanoseconds
+ * since the previous message and the size of the message (both as varints), then its bytes.
+ *
+ * The queue calls record() while holding its lock, so the recording has the exact order of the
+ * queue, and one recorder must not be shared between queues. record() only hands the message to the
+ * recorder's own thread, which serializes and writes it, so pushes never wait for the disk. Messages
+ * are serialized after the push and must not be modified by the nodes once pushed.
+ */
+class recorder {
+public:
+  using clock = std::chrono::steady_clock;
+
+private:
+  struct pending_record {
+    std::shared_ptr<message_type> msg;
+    clock::time_point when;
+  };
+
+  // only touched by the writer thread once it runs
+  std::ofstream out;
+  serialize_fun_t serialize;
+  std::string buffer;
+  clock::time_point last;
+  std::atomic<bool> good_ = false;
+  std::atomic<size_t> records_ = 0;
+
+  std::mutex mut;
+  std::condition_variable cv;
+  std::vector<pending_record> pending;
+  bool stopping = false;
+  std::thread writer;
+
+  void run();
+  void write(const message_type &msg, clock::time_point now);
+
+public:
+  recorder(const std::string &filename, serialize_fun_t serialize);
+  ~recorder();
+  recorder(const recorder &) = delete;
+  recorder &operator=(const recorder &) = delete;
+
+  bool is_open() const;
+  void record(std::shared_ptr<message_type> msg, clock::time_point now);
+  // writes what is still pending and closes the file
+  void close();
+  // messages written so far
+  size_t records() const;
+};
+
+struct replay_options {
+  // 1 replays at the original pace, 2 twice as fast, etc., 0 replays as fast as possible
+  double speed = 1.0;
+};
+
+/**
+ * Reads a recording back, sleeping between messages to reproduce the recorded timing.
+ */
+class replayer {
+public:
+  using clock = std::chrono::steady_clock;
+
+private:
+  buffer_slice recording;
+  size_t pos = 0;
+  deserialize_fun_t deserialize;
+  replay_options options;
+  bool is_open_ = false;
+  clock::time_point started;
+  std::chrono::nanoseconds elapsed{0};
+  size_t records_ = 0;
+
+  bool read_varint(uint64_t &value);
+
+public:
+  replayer(const std::string &filename, deserialize_fun_t deserialize, replay_options options);
+
+  bool is_open() const;
+  // returns nullptr after the last message
+  std::shared_ptr<message_type> next();
+  size_t records() const;
+};
@@ -0,0 +1,134 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "message_type.hpp"
+
+struct cache_stats {
+  size_t hits = 0;
+  // lookups that found the result still being computed by another node, and waited for it
+  size_t coalesced = 0;
+  size_t misses = 0;
+  size_t evictions = 0;
+  size_t entries = 0;
+  size_t capacity = 0;
+
+  double hit_ratio() const {
+    const auto total = hits + coalesced + misses;
+    return total ? double(hits + coalesced) / total : 0;
+  }
+};
+
+// updated without locks by the nodes using the cache, read by stats
+struct cache_counters {
+  std::atomic<size_t> hits = 0;
+  std::atomic<size_t> coalesced = 0;
+  std::atomic<size_t> misses = 0;
+  std::atomic<size_t> evictions = 0;
+  std::atomic<size_t> entries = 0;
+  size_t capacity = 0;
+
+  cache_stats read() const {
+    return {hits.load(), coalesced.load(), misses.load(), evictions.load(), entries.load(), capacity};
+  }
+};
+
+/**
+ * Thread-safe LRU cache of transform results by key, see pipeline_system::spawn_cached_transformer().
+ *
+ * The keys are spread over shards that each have their own lock and their own share of the capacity,
+ * so the nodes sharing the cache rarely contend. A key that is being computed is only computed once,
+ * concurrent lookups of it wait for the result instead of computing it again. Results are shared by
+ * everyone looking up the same key, so they must not be modified downstream.
+ */
+template <typename K, typename HASH = std::hash<K>>
+class result_cache {
+public:
+  using value_t = std::shared_ptr<message_type>;
+
+private:
+  struct shard {
+    std::mutex mut;
+    // most recently used first
+    std::list<std::pair<K, value_t>> lru;
+    std::unordered_map<K, typename std::list<std::pair<K, value_t>>::iterator, HASH> index;
+    std::unordered_map<K, std::shared_future<value_t>, HASH> in_flight;
+  };
+  std::vector<shard> shards_;
+  size_t shard_capacity_;
+  HASH hash_;
+  std::shared_ptr<cache_counters> counters_ = std::make_shared<cache_counters>();
+
+public:
+  explicit result_cache(size_t capacity, size_t shards = 16)
+      : shards_(std::max<size_t>(std::min(shards, capacity), 1)),
+        shard_capacity_(std::max<size_t>(capacity / shards_.size(), 1)) {
+    counters_->capacity = shard_capacity_ * shards_.size();
+  }
+
+  template <typename F>
+  value_t get_or_compute(const K &key, F &&compute) {
+    auto &s = shards_[hash_(key) % shards_.size()];
+    std::unique_lock lock(s.mut);
+    if (auto found = s.index.find(key); found != s.index.end()) {
+      s.lru.splice(s.lru.begin(), s.lru, found->second);
+      counters_->hits++;
+      return found->second->second;
+    }
+    if (auto found = s.in_flight.find(key); found != s.in_flight.end()) {
+      auto result = found->second;
+      lock.unlock();
+      counters_->coalesced++;
+      return result.get();
+    }
+    counters_->misses++;
+    std::promise<value_t> promise;
+    s.in_flight.emplace(key, promise.get_future().share());
+    lock.unlock();
+
+    value_t value;
+    try {
+      value = compute();
+    } catch (...) {
+      // the waiting lookups get the exception, the next one tries again
+      lock.lock();
+      s.in_flight.erase(key);
+      lock.unlock();
+      promise.set_exception(std::current_exception());
+      throw;
+    }
+
+    lock.lock();
+    s.in_flight.erase(key);
+    s.lru.emplace_front(key, value);
+    s.index[key] = s.lru.begin();
+    counters_->entries++;
+    if (s.lru.size() > shard_capacity_) {
+      s.index.erase(s.lru.back().first);
+      s.lru.pop_back();
+      counters_->entries--;
+      counters_->evictions++;
+    }
+    lock.unlock();
+    promise.set_value(value);
+    return value;
+  }
+
+  std::shared_ptr<const cache_counters> counters() const {
+    return counters_;
+  }
+};
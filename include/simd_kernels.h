@@ -0,0 +1,84 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "column_batch.h"
+
+enum class simd_level {
+  scalar,
+  sse2,
+  avx2,
+};
+
+/**
+ * Kernels over columns of doubles. Every kernel exists as AVX2, SSE2 and scalar code, the best one the
+ * CPU supports is picked at runtime, so binaries don't need to be built for a specific machine.
+ * Output columns may be the same as input columns.
+ */
+namespace simd {
+simd_level detected();
+// overrides the detected level, e.g. to compare implementations, levels the CPU lacks are ignored
+void force(simd_level level);
+simd_level active();
+const char *to_string(simd_level level);
+
+// map: out[i] = a[i] + b[i], a[i] * b[i], a[i] + s, a[i] * s, a[i]^2 + b[i]^2
+void add(const double *a, const double *b, double *out, size_t n);
+void mul(const double *a, const double *b, double *out, size_t n);
+void add(const double *a, double s, double *out, size_t n);
+void mul(const double *a, double s, double *out, size_t n);
+void sum_of_squares(const double *a, const double *b, double *out, size_t n);
+
+// filter: writes the indices of the rows where a[i] <= bound to out, returns how many
+size_t select_less_equal(const double *a, double bound, uint32_t *out, size_t n);
+size_t count_less_equal(const double *a, double bound, size_t n);
+
+// reduce
+double sum(const double *a, size_t n);
+double sum(const double *a, const uint32_t *rows, size_t n);
+
+// column versions, resizing the output as needed
+void sum_of_squares(const column<double> &a, const column<double> &b, column<double> &out);
+selection select_less_equal(const column<double> &a, double bound);
+double sum(const column<double> &a);
+double sum(const column<double> &a, const selection &rows);
+
+// generic kernels for other types and operations, plain loops the compiler can vectorize
+template <typename T, typename F>
+void map(const column<T> &in, column<T> &out, F &&fun) {
+  out.resize(in.size());
+  const T *__restrict src = in.data();
+  T *__restrict dst = out.data();
+  for (size_t i = 0; i < in.size(); i++) {
+    dst[i] = fun(src[i]);
+  }
+}
+
+template <typename T, typename P>
+selection filter(const column<T> &in, P &&predicate) {
+  selection ret(in.size());
+  size_t n = 0;
+  // branch free: always write, only advance on a match
+  for (size_t i = 0; i < in.size(); i++) {
+    ret[n] = uint32_t(i);
+    n += predicate(in[i]) ? 1 : 0;
+  }
+  ret.resize(n);
+  return ret;
+}
+
+template <typename T, typename R, typename F>
+R reduce(const column<T> &in, R init, F &&fun) {
+  for (const auto &v : in) {
+    init = fun(init, v);
+  }
+  return init;
+}
+}  // namespace simd
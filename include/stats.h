@@ -6,30 +6,85 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <vector>
 
+#include "fair_scheduler.h"
+#include "hedging.h"
+#include "perf_counters.h"
+#include "result_cache.h"
+
 class queue;
 
 class stats {
 public:
+  struct lane_stats {
+    int size = 0;
+    size_t popped = 0;
+    int64_t wait_ns = 0;
+  };
+
   struct node_stats {
     std::string name;
     bool is_storage;
     bool is_sleeping_until_not_full;
     bool is_sleeping_until_not_empty;
     int size;
+    size_t bytes;
+    // only for queues with an adaptive capacity
+    size_t capacity;
+    // only for queues with a byte limit
+    size_t max_bytes;
     bool active;
     size_t counter;
     size_t last_counter;
+    // payload bytes, only reported by nodes dealing in raw bytes such as file sources and sinks
+    size_t bytes_counter;
+    size_t last_bytes_counter;
+    // failed operations, only reported by nodes doing I/O such as file sinks
+    size_t errors;
+    // cumulative time accounting (nanoseconds), busy is whatever time isn't spent blocked
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point stopped;
+    int64_t busy_ns;
+    int64_t blocked_on_input_ns;
+    int64_t blocked_on_output_ns;
+    // waiting for a fair_scheduler slot, only with use_scheduler()
+    int64_t throttled_ns;
+    // only for queues with priority lanes
+    std::vector<lane_stats> lanes;
+    // only for nodes when perf counters are enabled, cumulative since start()
+    std::optional<perf_sample> perf;
+    perf_sample last_perf;
+  };
+
+  // bytes held by messages in all queues of the system, see pipeline_system::set_memory_budget()
+  struct memory_stats {
+    size_t in_flight_bytes = 0;
+    size_t peak_bytes = 0;
+    // 0 without a budget
+    size_t budget_bytes = 0;
   };
 
 private:
   mutable std::mutex stats_mut;
+  // changed on every push and pop of a sized message, so kept out of stats_mut
+  std::atomic<size_t> in_flight_bytes_ = 0;
+  std::atomic<size_t> peak_bytes_ = 0;
+  std::atomic<size_t> budget_bytes_ = 0;
+  std::optional<std::chrono::steady_clock::time_point> shutdown_deadline_;
+  std::shared_ptr<fair_scheduler> scheduler_;
+  std::shared_ptr<fair_scheduler::tenant> tenant_;
   std::map<std::string, node_stats> stats_;
+  std::map<std::string, std::shared_ptr<perf_counters>> perf_counters_;
+  std::map<std::string, std::shared_ptr<const cache_counters>> caches_;
+  std::map<std::string, std::shared_ptr<const hedge_group>> hedging_;
   struct vis {
     std::string input;
     std::string storage;
@@ -42,10 +97,53 @@ public:
   void set_type(const std::string& name, bool is_storage);
   void set_sleep_until_not_full(const std::string& name, bool val);
   void set_sleep_until_not_empty(const std::string& name, bool val);
-  void set_size(const std::string& name, int size);
+  void set_size(const std::string& name, int size, size_t bytes = 0);
+  void set_capacity(const std::string& name, size_t capacity);
+  void set_max_bytes(const std::string& name, size_t max_bytes);
+  void set_lane_size(const std::string& name, size_t lane, int size);
+  void add_lane_wait(const std::string& name, size_t lane, std::chrono::nanoseconds wait);
   void set_active(const std::string& name, bool active);
   void add_counter(const std::string& name);
+  void add_bytes(const std::string& name, size_t bytes);
+  void add_errors(const std::string& name, size_t errors);
+  void set_started(const std::string& name, std::chrono::steady_clock::time_point when);
+  void set_stopped(const std::string& name, std::chrono::steady_clock::time_point when);
+  void add_blocked_on_input(const std::string& name, std::chrono::nanoseconds blocked);
+  void add_blocked_on_output(const std::string& name, std::chrono::nanoseconds blocked);
+  void add_throttled(const std::string& name, std::chrono::nanoseconds throttled);
+  void set_perf_counters(const std::string& name, std::shared_ptr<perf_counters> counters);
+  // both return the bytes in flight afterwards
+  size_t add_in_flight_bytes(size_t bytes);
+  size_t remove_in_flight_bytes(size_t bytes);
+  void set_memory_budget(size_t bytes);
+  void set_cache(const std::string& name, std::shared_ptr<const cache_counters> counters);
+  void set_hedging(const std::string& name, std::shared_ptr<const hedge_group> group);
+  // shows the drain progress until the deadline, see pipeline_system::shutdown()
+  void set_shutdown_deadline(std::chrono::steady_clock::time_point deadline);
+  void set_tenant(std::shared_ptr<fair_scheduler> scheduler, std::shared_ptr<fair_scheduler::tenant> tenant);
   void setup(const std::vector<std::shared_ptr<queue>>& containers);
   void display();
   decltype(stats_) get_raw() const;
+  // calls fun(name, node_stats) for every node and queue under the stats lock, without copying them
+  template <typename F>
+  void visit(F&& fun) const {
+    std::scoped_lock sl(stats_mut);
+    for (const auto& [name, s] : stats_) {
+      fun(name, s);
+    }
+  }
+  // like get_raw(), with the nodes and queues of replicate()d graphs summed up under their base name
+  decltype(stats_) get_merged() const;
+  memory_stats get_memory() const;
+  // result caches of cached transformers, by the name of the stage that created them
+  std::map<std::string, cache_stats> get_caches() const;
+  // hedged worker pools, by the name of their input queue
+  std::map<std::string, hedging_stats> get_hedging() const;
+  // only for systems sharing a fair_scheduler
+  std::optional<tenant_share> get_cpu_share() const;
+
+private:
+  void read_perf_counters(decltype(stats_)& into) const;
+  std::map<std::string, cache_stats> read_caches() const;
+  std::map<std::string, hedging_stats> read_hedging() const;
 };
@@ -0,0 +1,80 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum class trace_kind : uint8_t {
+  produce,
+  transform,
+  consume,
+  wait_input,
+  wait_output,
+  wakeup,
+};
+
+/**
+ * Records spans from node threads into per-thread ring buffers and exports them in the Chrome
+ * trace-event format (load the output in https://ui.perfetto.dev or chrome://tracing).
+ *
+ * Each ring is written only by the thread owning it, the dumper reads the rings without locking and
+ * discards entries that may have been overwritten while copying. When disabled the cost of a trace
+ * call is a single relaxed atomic load.
+ */
+class tracer {
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct event {
+    trace_kind kind;
+    int64_t begin_ns;
+    int64_t end_ns;
+  };
+
+  class ring {
+  private:
+    friend class tracer;
+    std::string thread_name;
+    std::vector<event> events;
+    std::atomic<uint64_t> head = 0;
+    uint64_t sample_counter = 0;
+
+  public:
+    ring(std::string thread_name, size_t capacity);
+  };
+
+private:
+  std::atomic<bool> enabled_ = false;
+  std::atomic<size_t> sample_every_ = 1;
+  size_t capacity_ = 65536;
+  clock::time_point epoch_ = clock::now();
+  std::mutex rings_mut;
+  std::vector<std::shared_ptr<ring>> rings;
+
+public:
+  /**
+   * Start recording, keeping the last events_per_thread events for each thread. With sample_every > 1
+   * only one in every sample_every events is recorded, which keeps overhead low enough for production.
+   */
+  void enable(size_t sample_every = 1, size_t events_per_thread = 65536);
+  void disable();
+  bool enabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  std::shared_ptr<ring> register_thread(const std::string &thread_name);
+  void record(ring &r, trace_kind kind, clock::time_point begin, clock::time_point end);
+
+  void dump(std::ostream &os);
+  bool dump(const std::string &filename);
+};
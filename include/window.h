@@ -0,0 +1,125 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "message_type.hpp"
+
+/**
+ * Messages collected by a window stage, emitted downstream as a single message.
+ */
+template <typename T>
+struct batch : public message_type {
+  std::vector<std::shared_ptr<T>> items;
+};
+
+template <typename T, typename K>
+struct keyed_batch : public batch<T> {
+  K key;
+  explicit keyed_batch(K key) : key(std::move(key)) {}
+};
+
+struct window_options {
+  // flush a window once it holds this many messages, 0 for no limit
+  size_t max_items = 0;
+  // flush a window this long after it received its first message, 0 for no limit
+  std::chrono::milliseconds linger{0};
+};
+
+/**
+ * State of the tumbling windows of a single window node, one open window per key.
+ * Windows never overlap: when a window is flushed the next message for its key opens a new one.
+ */
+template <typename T, typename K>
+class window_state {
+public:
+  using clock = std::chrono::steady_clock;
+  using key_fun_t = std::function<K(const T &)>;
+
+private:
+  struct open_window {
+    clock::time_point opened;
+    std::shared_ptr<keyed_batch<T, K>> batch;
+  };
+  window_options options;
+  key_fun_t key_fun;
+  std::map<K, open_window> windows;
+  // windows in the order they were opened, since linger is fixed this is also the order they expire in
+  std::deque<std::pair<clock::time_point, K>> expiry;
+
+public:
+  window_state(window_options options, key_fun_t key_fun);
+
+  std::vector<std::shared_ptr<message_type>> add(std::shared_ptr<T> item);
+  std::vector<std::shared_ptr<message_type>> flush(clock::time_point now);
+  std::optional<clock::time_point> deadline() const;
+};
+
+template <typename T, typename K>
+window_state<T, K>::window_state(window_options options, key_fun_t key_fun)
+    : options(options), key_fun(std::move(key_fun)) {}
+
+template <typename T, typename K>
+std::vector<std::shared_ptr<message_type>> window_state<T, K>::add(std::shared_ptr<T> item) {
+  std::vector<std::shared_ptr<message_type>> ret;
+  if (!item) {
+    return ret;
+  }
+  auto key = key_fun(*item);
+  auto find = windows.find(key);
+  if (find == windows.end()) {
+    const auto now = clock::now();
+    find = windows.emplace(key, open_window{now, std::make_shared<keyed_batch<T, K>>(key)}).first;
+    if (options.linger.count() > 0) {
+      expiry.emplace_back(now, std::move(key));
+    }
+  }
+  find->second.batch->items.push_back(std::move(item));
+  if (options.max_items > 0 && find->second.batch->items.size() >= options.max_items) {
+    ret.push_back(std::move(find->second.batch));
+    windows.erase(find);
+  }
+  return ret;
+}
+
+template <typename T, typename K>
+std::vector<std::shared_ptr<message_type>> window_state<T, K>::flush(clock::time_point now) {
+  std::vector<std::shared_ptr<message_type>> ret;
+  if (now == clock::time_point::max()) {
+    for (auto &[_, window] : windows) {
+      ret.push_back(std::move(window.batch));
+    }
+    windows.clear();
+    expiry.clear();
+    return ret;
+  }
+  while (!expiry.empty() && now - expiry.front().first >= options.linger) {
+    const auto &[opened, key] = expiry.front();
+    // the window may already have been flushed because it was full
+    if (auto find = windows.find(key); find != windows.end() && find->second.opened == opened) {
+      ret.push_back(std::move(find->second.batch));
+      windows.erase(find);
+    }
+    expiry.pop_front();
+  }
+  return ret;
+}
+
+template <typename T, typename K>
+std::optional<typename window_state<T, K>::clock::time_point> window_state<T, K>::deadline() const {
+  if (expiry.empty()) {
+    return std::nullopt;
+  }
+  return expiry.front().first + options.linger;
+}
@@ -0,0 +1,116 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "bottleneck_analyzer.h"
+
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include "node.h"
+#include "pipeline_system.h"
+
+bottleneck_analyzer::bottleneck_analyzer(pipeline_system &sys) : system(sys) {}
+
+bottleneck_analyzer::report bottleneck_analyzer::analyze() const {
+  report ret;
+  const auto raw = system.get_stats().get_raw();
+
+  // group replicas: consumers by (input queue, consumer id), producers by the queues they push to,
+  // routed producers are only replicas of producers routing to the same queues
+  std::map<std::pair<std::vector<const queue *>, int64_t>, size_t> groups;
+  std::vector<std::vector<node *>> members;
+  for (const auto &n : system.nodes) {
+    auto in = n->get_input_queue();
+    std::vector<const queue *> key_queues;
+    if (in) {
+      key_queues.push_back(in.get());
+    } else {
+      for (const auto &out : n->get_output_queues()) key_queues.push_back(out.get());
+    }
+    auto [it, inserted] = groups.emplace(std::make_pair(key_queues, in ? n->id() : int64_t(-1)), members.size());
+    if (inserted) members.emplace_back();
+    members[it->second].push_back(n);
+  }
+
+  for (const auto &group : members) {
+    stage s;
+    double busy = 0, input = 0, output = 0;
+    for (const auto &n : group) {
+      s.replicas.push_back(n->name());
+      const auto find = raw.find(n->name());
+      if (find == raw.end()) continue;
+      const auto &ns = find->second;
+      s.messages += ns.counter;
+      busy += ns.busy_ns;
+      input += ns.blocked_on_input_ns;
+      output += ns.blocked_on_output_ns;
+      if (ns.busy_ns > 0) {
+        s.capacity += ns.counter / (ns.busy_ns / 1e9);
+      }
+    }
+    s.name = s.replicas.front();
+    if (s.replicas.size() > 1) {
+      s.name += " (x" + std::to_string(s.replicas.size()) + ")";
+    }
+    if (const auto total = busy + input + output; total > 0) {
+      s.utilization = busy / total;
+      s.starved = input / total;
+      s.back_pressured = output / total;
+    }
+    ret.stages.push_back(s);
+  }
+
+  // the stage with the lowest capacity limits throughput for the entire pipeline
+  double runner_up = std::numeric_limits<double>::infinity();
+  for (size_t i = 0; i < ret.stages.size(); i++) {
+    const auto &s = ret.stages[i];
+    if (s.messages == 0 || s.capacity <= 0) continue;
+    if (!ret.bottleneck || s.capacity < ret.stages[*ret.bottleneck].capacity) {
+      if (ret.bottleneck) runner_up = std::min(runner_up, ret.stages[*ret.bottleneck].capacity);
+      ret.bottleneck = i;
+    } else {
+      runner_up = std::min(runner_up, s.capacity);
+    }
+  }
+  if (ret.bottleneck) {
+    const auto &s = ret.stages[*ret.bottleneck];
+    ret.throughput = s.capacity;
+    const auto with_replica = s.capacity + s.capacity / s.replicas.size();
+    ret.estimated_gain = std::min(with_replica, runner_up) / s.capacity - 1.0;
+  }
+  return ret;
+}
+
+std::string bottleneck_analyzer::report::summary() const {
+  std::stringstream ss;
+  if (!bottleneck) {
+    ss << "bottleneck: not enough data";
+    return ss.str();
+  }
+  const auto &s = stages[*bottleneck];
+  ss << std::fixed << std::setprecision(0);
+  ss << "bottleneck: " << s.name << ", busy " << s.utilization * 100 << "%, " << throughput << " msg/s, +"
+     << estimated_gain * 100 << "% with one more replica";
+  return ss.str();
+}
+
+std::string bottleneck_analyzer::report::to_string() const {
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(1);
+  for (size_t i = 0; i < stages.size(); i++) {
+    const auto &s = stages[i];
+    ss << (bottleneck && *bottleneck == i ? "* " : "  ") << std::left << std::setw(24) << s.name << std::right
+       << " busy " << std::setw(5) << s.utilization * 100 << "%"
+       << " starved " << std::setw(5) << s.starved * 100 << "%"
+       << " blocked " << std::setw(5) << s.back_pressured * 100 << "%"
+       << " capacity " << std::setw(10) << s.capacity << " msg/s" << std::endl;
+  }
+  ss << summary() << std::endl;
+  return ss.str();
+}
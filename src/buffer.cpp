@@ -0,0 +1,94 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "buffer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+struct heap_slab : public slab {
+  std::unique_ptr<char[]> storage;
+  explicit heap_slab(size_t n) : storage(new char[n]) {
+    data = storage.get();
+    size = n;
+  }
+};
+
+struct mapped_slab : public slab {
+  mapped_slab(char *ptr, size_t n) {
+    data = ptr;
+    size = n;
+  }
+  ~mapped_slab() override {
+    if (data) munmap(data, size);
+  }
+};
+}  // namespace
+
+buffer_slice::buffer_slice(std::shared_ptr<slab> owner, char *data, size_t size)
+    : owner_(std::move(owner)), data_(data), size_(size) {}
+
+buffer_slice buffer_slice::slice(size_t offset, size_t length) const {
+  offset = std::min(offset, size_);
+  length = std::min(length, size_ - offset);
+  return buffer_slice(owner_, data_ + offset, length);
+}
+
+buffer_slice buffer_slice::allocate(size_t size) {
+  auto s = std::make_shared<heap_slab>(size);
+  return buffer_slice(s, s->data, size);
+}
+
+buffer_slice buffer_slice::copy_of(std::string_view bytes) {
+  auto ret = allocate(bytes.size());
+  std::memcpy(ret.mutable_data(), bytes.data(), bytes.size());
+  return ret;
+}
+
+std::optional<buffer_slice> buffer_slice::map_file(const std::string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return std::nullopt;
+  }
+  struct stat st {};
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return std::nullopt;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return buffer_slice();
+  }
+  auto *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    return std::nullopt;
+  }
+  auto s = std::make_shared<mapped_slab>(static_cast<char *>(ptr), st.st_size);
+  return buffer_slice(s, s->data, s->size);
+}
+
+slab_allocator::slab_allocator(size_t slab_size) : slab_size_(slab_size) {}
+
+buffer_slice slab_allocator::allocate(size_t size) {
+  // payloads bigger than a slab get a slab of their own
+  if (size > slab_size_) {
+    return buffer_slice::allocate(size);
+  }
+  if (!current_ || used_ + size > slab_size_) {
+    current_ = std::make_shared<heap_slab>(slab_size_);
+    used_ = 0;
+  }
+  buffer_slice ret(current_, current_->data + used_, size);
+  used_ += size;
+  return ret;
+}
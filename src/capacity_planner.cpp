@@ -0,0 +1,457 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "capacity_planner.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <iomanip>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <tuple>
+
+#include "node.h"
+#include "pipeline_system.h"
+
+namespace {
+constexpr double default_service_time = 1e-6;
+constexpr size_t latency_reservoir = 100000;
+
+/**
+ * Servers block after service: a replica that cannot push its output into a full queue holds on
+ * to it, like node::push() does. Batches are pushed as a whole once there is room for one item.
+ */
+class simulation {
+private:
+  struct item {
+    double created;
+    size_t remaining;
+  };
+  struct sim_queue {
+    std::string name;
+    size_t max_items;
+    std::vector<size_t> consumers;           // stage indices
+    std::vector<std::deque<size_t>> pending;  // item indices, per consumer stage
+    size_t occupancy = 0;
+    std::deque<size_t> blocked;  // servers waiting for room
+    double area = 0;
+    double last_change = 0;
+    size_t max_depth = 0;
+  };
+  struct server {
+    size_t stage;
+    double busy_since = 0;
+    double busy_time = 0;
+    double created = 0;
+    std::vector<double> holding;
+  };
+  struct stage {
+    const capacity_planner::stage_model *model;
+    std::optional<size_t> input;
+    std::vector<size_t> outputs;
+    // cumulative shares of the outputs, to pick one per message
+    std::vector<double> shares;
+    size_t slot = 0;  // index in the consumers of the input queue
+    size_t replicas;
+    std::deque<size_t> idle;
+  };
+  struct event {
+    double time;
+    uint64_t seq;
+    size_t server;
+    bool operator>(const event &other) const {
+      return std::tie(time, seq) > std::tie(other.time, other.seq);
+    }
+  };
+
+  const simulation_options &opts;
+  std::mt19937_64 rng;
+  std::uniform_real_distribution<double> uniform{0.0, 1.0};
+  std::vector<stage> stages;
+  std::vector<sim_queue> queues;
+  std::vector<server> servers;
+  std::vector<item> items;
+  std::vector<size_t> free_items;
+  std::priority_queue<event, std::vector<event>, std::greater<>> events;
+  uint64_t seq = 0;
+  double now = 0;
+  size_t completed = 0;
+  std::vector<double> latencies;
+
+  double sample(const capacity_planner::service_model &m) {
+    const auto mean = m.mean > 0 ? m.mean : default_service_time;
+    switch (m.dist) {
+      case capacity_planner::distribution::constant:
+        return mean;
+      case capacity_planner::distribution::exponential:
+        return -mean * std::log(1.0 - uniform(rng));
+      case capacity_planner::distribution::empirical:
+        if (m.samples.empty()) return mean;
+        return std::max(m.samples[size_t(uniform(rng) * m.samples.size()) % m.samples.size()], 0.0);
+    }
+    return mean;
+  }
+
+  size_t sample_fan_out(double fan_out) {
+    const auto whole = std::floor(fan_out);
+    return size_t(whole) + (uniform(rng) < fan_out - whole ? 1 : 0);
+  }
+
+  void complete(double created) {
+    if (now < opts.warmup) return;
+    completed++;
+    // reservoir sampling keeps the percentiles representative with bounded memory
+    if (latencies.size() < latency_reservoir) {
+      latencies.push_back(now - created);
+    } else if (auto i = size_t(uniform(rng) * completed); i < latency_reservoir) {
+      latencies[i] = now - created;
+    }
+  }
+
+  void depth_changed(sim_queue &q, int delta) {
+    if (now > opts.warmup) {
+      q.area += q.occupancy * (now - std::max(q.last_change, opts.warmup));
+    }
+    q.last_change = now;
+    q.occupancy += delta;
+    if (now >= opts.warmup) q.max_depth = std::max(q.max_depth, q.occupancy);
+  }
+
+  void start_service(size_t id, double created) {
+    auto &srv = servers[id];
+    srv.created = created;
+    srv.busy_since = now;
+    events.push(event{now + sample(stages[srv.stage].model->service), seq++, id});
+  }
+
+  void push_items(size_t qi, const std::vector<double> &created) {
+    auto &q = queues[qi];
+    for (const auto &c : created) {
+      if (q.consumers.empty()) {
+        complete(c);
+        continue;
+      }
+      size_t index;
+      if (free_items.empty()) {
+        index = items.size();
+        items.push_back(item{c, q.consumers.size()});
+      } else {
+        index = free_items.back();
+        free_items.pop_back();
+        items[index] = item{c, q.consumers.size()};
+      }
+      for (auto &pending : q.pending) pending.push_back(index);
+      depth_changed(q, 1);
+    }
+    for (size_t i = 0; i < q.consumers.size(); i++) {
+      auto &st = stages[q.consumers[i]];
+      while (!st.idle.empty() && !queues[qi].pending[i].empty()) {
+        const auto id = st.idle.front();
+        st.idle.pop_front();
+        pull(id);
+      }
+    }
+  }
+
+  void unblock(size_t qi) {
+    while (!queues[qi].blocked.empty() && queues[qi].occupancy < queues[qi].max_items) {
+      const auto id = queues[qi].blocked.front();
+      queues[qi].blocked.pop_front();
+      auto holding = std::move(servers[id].holding);
+      servers[id].holding.clear();
+      push_items(qi, holding);
+      next(id);
+    }
+  }
+
+  void pull(size_t id) {
+    auto &st = stages[servers[id].stage];
+    auto &q = queues[*st.input];
+    auto &pending = q.pending[st.slot];
+    if (pending.empty()) {
+      st.idle.push_back(id);
+      return;
+    }
+    const auto index = pending.front();
+    pending.pop_front();
+    const auto created = items[index].created;
+    if (--items[index].remaining == 0) {
+      free_items.push_back(index);
+      depth_changed(q, -1);
+      start_service(id, created);
+      unblock(*st.input);
+      return;
+    }
+    start_service(id, created);
+  }
+
+  size_t pick_output(const stage &st) {
+    if (st.outputs.size() == 1) {
+      return st.outputs.front();
+    }
+    const auto r = uniform(rng) * st.shares.back();
+    const auto i = std::upper_bound(st.shares.begin(), st.shares.end(), r) - st.shares.begin();
+    return st.outputs[std::min(size_t(i), st.outputs.size() - 1)];
+  }
+
+  // a server that is done with its output picks up the next message
+  void next(size_t id) {
+    const auto &st = stages[servers[id].stage];
+    if (st.input) {
+      pull(id);
+    } else {
+      start_service(id, now);
+    }
+  }
+
+  void done(size_t id) {
+    auto &srv = servers[id];
+    srv.busy_time += std::max(now - std::max(srv.busy_since, opts.warmup), 0.0);
+    const auto &st = stages[srv.stage];
+    if (st.outputs.empty()) {
+      complete(srv.created);
+      next(id);
+      return;
+    }
+    // producers stamp messages when they are created
+    const auto created = st.input ? srv.created : now;
+    srv.holding.assign(sample_fan_out(st.model->fan_out), created);
+    const auto output = pick_output(st);
+    auto &q = queues[output];
+    if (q.occupancy >= q.max_items) {
+      q.blocked.push_back(id);
+      return;
+    }
+    auto holding = std::move(srv.holding);
+    srv.holding.clear();
+    push_items(output, holding);
+    next(id);
+  }
+
+public:
+  simulation(const capacity_planner &planner, const capacity_planner::scenario &s, const simulation_options &o)
+      : opts(o), rng(o.seed) {
+    std::map<std::string, size_t> queue_index;
+    for (const auto &qm : planner.queues) {
+      const auto find = s.max_items.find(qm.name);
+      const auto max_items = find != s.max_items.end() ? find->second : qm.max_items;
+      queue_index[qm.name] = queues.size();
+      queues.push_back(sim_queue{qm.name, std::max(max_items, size_t(1))});
+    }
+    for (const auto &sm : planner.stages) {
+      stage st{&sm};
+      if (sm.input && queue_index.count(*sm.input)) st.input = queue_index[*sm.input];
+      double total = 0;
+      for (const auto &out : sm.outputs) {
+        if (!queue_index.count(out.queue)) continue;
+        total += std::max(out.share, 0.0);
+        st.outputs.push_back(queue_index[out.queue]);
+        st.shares.push_back(total);
+      }
+      const auto find = s.replicas.find(sm.name);
+      st.replicas = find != s.replicas.end() ? find->second : sm.replicas;
+      if (st.input) {
+        auto &q = queues[*st.input];
+        st.slot = q.consumers.size();
+        q.consumers.push_back(stages.size());
+        q.pending.emplace_back();
+      }
+      stages.push_back(st);
+    }
+  }
+
+  capacity_planner::result run() {
+    for (size_t i = 0; i < stages.size(); i++) {
+      for (size_t r = 0; r < stages[i].replicas; r++) {
+        servers.push_back(server{i});
+      }
+    }
+    for (size_t id = 0; id < servers.size(); id++) {
+      next(id);
+    }
+    while (!events.empty() && events.top().time <= opts.duration) {
+      const auto ev = events.top();
+      events.pop();
+      now = ev.time;
+      done(ev.server);
+    }
+    now = opts.duration;
+
+    capacity_planner::result ret;
+    const auto measured = std::max(opts.duration - opts.warmup, 1e-9);
+    ret.throughput = completed / measured;
+    if (!latencies.empty()) {
+      std::sort(latencies.begin(), latencies.end());
+      auto percentile = [&](double p) { return latencies[size_t(p * (latencies.size() - 1))]; };
+      ret.latency_p50 = percentile(0.50);
+      ret.latency_p95 = percentile(0.95);
+      ret.latency_p99 = percentile(0.99);
+    }
+    // services still in progress at the end count as busy until the end
+    std::vector<double> busy(stages.size(), 0);
+    for (const auto &srv : servers) {
+      busy[srv.stage] += srv.busy_time;
+    }
+    while (!events.empty()) {
+      const auto &srv = servers[events.top().server];
+      busy[srv.stage] += std::max(now - std::max(srv.busy_since, opts.warmup), 0.0);
+      events.pop();
+    }
+    for (size_t i = 0; i < stages.size(); i++) {
+      const auto replicas = stages[i].replicas;
+      ret.stages.push_back({stages[i].model->name, replicas, replicas ? busy[i] / (measured * replicas) : 0});
+    }
+    for (auto &q : queues) {
+      depth_changed(q, 0);
+      ret.queues.push_back({q.name, q.max_items, q.area / measured, q.max_depth});
+    }
+    return ret;
+  }
+};
+}  // namespace
+
+capacity_planner::capacity_planner(pipeline_system &sys) {
+  const auto raw = sys.get_stats().get_raw();
+  for (const auto &q : sys.containers) {
+    queues.push_back(queue_model{q->name, q->max_items});
+  }
+
+  // group replicas like the bottleneck_analyzer: consumers by (input queue, consumer id), producers by output queues
+  std::map<std::pair<std::vector<const queue *>, int64_t>, size_t> groups;
+  std::vector<size_t> messages;
+  std::vector<double> busy;
+  for (const auto &n : sys.nodes) {
+    auto in = n->get_input_queue();
+    auto outputs = n->get_output_queues();
+    std::vector<const queue *> key_queues;
+    if (in) {
+      key_queues.push_back(in.get());
+    } else {
+      for (const auto &out : outputs) key_queues.push_back(out.get());
+    }
+    auto [it, inserted] = groups.emplace(std::make_pair(key_queues, in ? n->id() : int64_t(-1)), stages.size());
+    if (inserted) {
+      stage_model sm;
+      sm.name = n->name();
+      if (in) sm.input = in->name;
+      for (const auto &out : outputs) {
+        sm.outputs.push_back(output_model{out->name, 1.0 / outputs.size()});
+      }
+      sm.replicas = 0;
+      stages.push_back(sm);
+      messages.push_back(0);
+      busy.push_back(0);
+    }
+    stages[it->second].replicas++;
+    if (const auto find = raw.find(n->name()); find != raw.end()) {
+      messages[it->second] += find->second.counter;
+      busy[it->second] += find->second.busy_ns / 1e9;
+    }
+  }
+
+  for (size_t i = 0; i < stages.size(); i++) {
+    if (messages[i] > 0) {
+      stages[i].service.mean = busy[i] / messages[i];
+    }
+  }
+  // messages taken from a queue by the first of its consumer stages
+  const auto downstream = [&](const std::string &q) -> std::optional<size_t> {
+    for (size_t i = 0; i < stages.size(); i++) {
+      if (stages[i].input == q) return messages[i];
+    }
+    return std::nullopt;
+  };
+  // routers split their messages over the outputs in proportion to what was taken from them, the
+  // even split stays when nothing was measured
+  for (auto &sm : stages) {
+    if (sm.outputs.size() < 2) continue;
+    size_t total = 0;
+    for (const auto &out : sm.outputs) total += downstream(out.queue).value_or(0);
+    if (total == 0) continue;
+    for (auto &out : sm.outputs) {
+      out.share = double(downstream(out.queue).value_or(0)) / total;
+    }
+  }
+  // fan-out: messages taken from the output queues per message processed, over the producing stages' shares
+  std::map<std::string, double> upstream;
+  for (size_t i = 0; i < stages.size(); i++) {
+    for (const auto &out : stages[i].outputs) upstream[out.queue] += messages[i] * out.share;
+  }
+  for (auto &sm : stages) {
+    double fan_out = 0, measured = 0;
+    for (const auto &out : sm.outputs) {
+      const auto taken = downstream(out.queue);
+      if (upstream[out.queue] > 0 && taken && *taken > 0) {
+        fan_out += out.share * *taken / upstream[out.queue];
+        measured += out.share;
+      }
+    }
+    if (measured > 0) {
+      sm.fan_out = fan_out / measured;
+    }
+  }
+}
+
+capacity_planner::result capacity_planner::simulate(const scenario &s, const simulation_options &o) const {
+  return simulation(*this, s, o).run();
+}
+
+std::vector<capacity_planner::result> capacity_planner::compare(const std::vector<scenario> &scenarios,
+                                                                const simulation_options &o) const {
+  std::vector<result> ret;
+  for (const auto &s : scenarios) {
+    ret.push_back(simulate(s, o));
+  }
+  return ret;
+}
+
+capacity_planner::scenario capacity_planner::plan(double target_throughput,
+                                                  size_t extra_replicas,
+                                                  const simulation_options &o) const {
+  scenario ret;
+  for (const auto &sm : stages) {
+    ret.replicas[sm.name] = sm.replicas;
+  }
+  auto best = simulate(ret, o);
+  for (size_t i = 0; i < extra_replicas && best.throughput < target_throughput; i++) {
+    std::optional<size_t> busiest;
+    for (size_t j = 0; j < stages.size(); j++) {
+      if (!stages[j].input) continue;
+      if (!busiest || best.stages[j].utilization > best.stages[*busiest].utilization) busiest = j;
+    }
+    if (!busiest) {
+      break;
+    }
+    auto candidate = ret;
+    candidate.replicas[stages[*busiest].name]++;
+    auto r = simulate(candidate, o);
+    // the target is out of reach when replicas no longer help, e.g. because the producers are saturated
+    if (r.throughput <= best.throughput * 1.01) {
+      break;
+    }
+    ret = std::move(candidate);
+    best = std::move(r);
+  }
+  return ret;
+}
+
+std::string capacity_planner::result::to_string() const {
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(1);
+  for (const auto &s : stages) {
+    ss << "  " << std::left << std::setw(24) << s.name << std::right << " x" << std::setw(3) << s.replicas << " busy "
+       << std::setw(5) << s.utilization * 100 << "%" << std::endl;
+  }
+  for (const auto &q : queues) {
+    ss << "  " << std::left << std::setw(24) << q.name << std::right << " max " << std::setw(6) << q.max_items
+       << " mean depth " << std::setw(8) << q.mean_depth << " max depth " << std::setw(6) << q.max_depth << std::endl;
+  }
+  ss << std::setprecision(0) << "throughput: " << throughput << " msg/s, latency p50/p95/p99: " << std::setprecision(3)
+     << latency_p50 * 1e3 << "/" << latency_p95 * 1e3 << "/" << latency_p99 * 1e3 << " ms" << std::endl;
+  return ss.str();
+}
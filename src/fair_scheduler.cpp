@@ -0,0 +1,151 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "fair_scheduler.h"
+
+#include <algorithm>
+#include <optional>
+
+fair_scheduler::fair_scheduler(size_t threads, std::chrono::microseconds quantum)
+    : free_slots_(std::max(threads, size_t(1))), quantum_(quantum) {}
+
+std::shared_ptr<fair_scheduler::tenant> fair_scheduler::add_tenant(std::string name, double weight) {
+  auto ret = std::make_shared<tenant>();
+  ret->name = std::move(name);
+  ret->weight = weight > 0 ? weight : 1;
+  std::scoped_lock lock(mut_);
+  tenants_.push_back(ret);
+  return ret;
+}
+
+void fair_scheduler::remove_tenant(const std::shared_ptr<tenant> &t) {
+  std::scoped_lock lock(mut_);
+  tenants_.erase(std::remove(tenants_.begin(), tenants_.end(), t), tenants_.end());
+}
+
+fair_scheduler::tenant *fair_scheduler::next_unprotected() const {
+  tenant *ret = nullptr;
+  for (const auto &t : tenants_) {
+    if (t->waiting > 0 && (!ret || t->vtime < ret->vtime)) {
+      ret = t.get();
+    }
+  }
+  return ret;
+}
+
+bool fair_scheduler::acquire(tenant &t) {
+  std::unique_lock lock(mut_);
+  if (t.cancelled) {
+    return false;
+  }
+  // a tenant coming back from idle starts level with the busy ones instead of far behind them
+  if (t.running == 0 && t.waiting == 0 && clock::now() - t.last_release > quantum_) {
+    std::optional<double> min_vtime;
+    for (const auto &other : tenants_) {
+      if (other.get() != &t && (other->running > 0 || other->waiting > 0)) {
+        min_vtime = std::min(min_vtime.value_or(other->vtime), other->vtime);
+      }
+    }
+    if (min_vtime) t.vtime = std::max(t.vtime, *min_vtime);
+  }
+  if (free_slots_ > 0 && waiting_ == 0) {
+    free_slots_--;
+    t.running++;
+    return true;
+  }
+  return wait_unprotected(lock, t);
+}
+
+void fair_scheduler::release(tenant &t, clock::duration held) {
+  {
+    std::scoped_lock lock(mut_);
+    release_unprotected(t, held);
+    if (waiting_ == 0) {
+      return;
+    }
+  }
+  cv_.notify_all();
+}
+
+bool fair_scheduler::yield(tenant &t, clock::duration held) {
+  std::unique_lock lock(mut_);
+  release_unprotected(t, held);
+  // queues up before the others are woken, so the slot goes to whoever is entitled to it, this tenant included
+  cv_.notify_all();
+  return !t.cancelled && wait_unprotected(lock, t);
+}
+
+void fair_scheduler::cancel(tenant &t) {
+  {
+    std::scoped_lock lock(mut_);
+    t.cancelled = true;
+  }
+  cv_.notify_all();
+}
+
+void fair_scheduler::release_unprotected(tenant &t, clock::duration held) {
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(held).count();
+  free_slots_++;
+  t.running--;
+  t.cpu_ns += ns;
+  t.vtime += ns / t.weight;
+  t.last_release = clock::now();
+}
+
+bool fair_scheduler::wait_unprotected(std::unique_lock<std::mutex> &lock, tenant &t) {
+  t.waiting++;
+  waiting_++;
+  const auto ticket = t.next_ticket++;
+  const auto begin = clock::now();
+  cv_.wait(lock, [&]() {
+    return t.cancelled || (free_slots_ > 0 && next_unprotected() == &t && t.serving == ticket);
+  });
+  t.wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - begin).count();
+  t.waiting--;
+  waiting_--;
+  if (t.cancelled) {
+    // the tenant may have been first in line, the others get to check again
+    cv_.notify_all();
+    return false;
+  }
+  t.serving++;
+  free_slots_--;
+  t.running++;
+  // more slots may be free than this one, let the next in line check
+  if (free_slots_ > 0 && waiting_ > 0) {
+    cv_.notify_all();
+  }
+  return true;
+}
+
+tenant_share fair_scheduler::share_unprotected(const tenant &t) const {
+  int64_t total_ns = 0;
+  double total_weight = 0;
+  for (const auto &other : tenants_) {
+    total_ns += other->cpu_ns;
+    total_weight += other->weight;
+  }
+  return tenant_share{t.name,
+                      t.weight,
+                      t.cpu_ns,
+                      t.wait_ns,
+                      total_ns > 0 ? double(t.cpu_ns) / total_ns : 0,
+                      total_weight > 0 ? t.weight / total_weight : 0};
+}
+
+std::vector<tenant_share> fair_scheduler::shares() const {
+  std::scoped_lock lock(mut_);
+  std::vector<tenant_share> ret;
+  for (const auto &t : tenants_) {
+    ret.push_back(share_unprotected(*t));
+  }
+  return ret;
+}
+
+tenant_share fair_scheduler::share_of(const tenant &t) const {
+  std::scoped_lock lock(mut_);
+  return share_unprotected(t);
+}
@@ -0,0 +1,518 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "file_io.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define PIPER_HAVE_IO_URING 1
+#endif
+
+class file_writer {
+protected:
+  // updated as writes complete, also from the pwrite thread
+  std::atomic<size_t> written_ = 0;
+  std::atomic<size_t> errors_ = 0;
+
+  void completed(bool ok, size_t bytes) {
+    written_ += bytes;
+    if (!ok) errors_++;
+  }
+
+public:
+  virtual ~file_writer() = default;
+  // the slices are kept alive until they have been written
+  virtual void write(std::vector<buffer_slice> slices, size_t offset) = 0;
+  virtual void wait() = 0;
+
+  size_t written() const {
+    return written_;
+  }
+  size_t errors() const {
+    return errors_;
+  }
+};
+
+namespace {
+std::vector<iovec> to_iovecs(const std::vector<buffer_slice> &slices) {
+  std::vector<iovec> ret;
+  ret.reserve(slices.size());
+  for (const auto &s : slices) {
+    ret.push_back(iovec{const_cast<char *>(s.data()), s.size()});
+  }
+  return ret;
+}
+
+// skip the first n bytes of the iovecs, returns the index of the first iovec with bytes left
+size_t advance(std::vector<iovec> &iov, size_t i, size_t n) {
+  while (n > 0 && i < iov.size()) {
+    if (n >= iov[i].iov_len) {
+      n -= iov[i].iov_len;
+      i++;
+    } else {
+      iov[i].iov_base = static_cast<char *>(iov[i].iov_base) + n;
+      iov[i].iov_len -= n;
+      n = 0;
+    }
+  }
+  return i;
+}
+
+// adds the bytes that made it to written, also when it fails halfway
+bool pwrite_all(int fd, std::vector<iovec> iov, size_t i, size_t offset, size_t &written) {
+  while (i < iov.size()) {
+    const auto count = int(std::min(iov.size() - i, size_t(IOV_MAX)));
+    const auto n = pwritev(fd, &iov[i], count, offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    offset += n;
+    written += n;
+    i = advance(iov, i, n);
+  }
+  return true;
+}
+
+class thread_writer : public file_writer {
+private:
+  struct request {
+    std::vector<buffer_slice> slices;
+    size_t offset;
+  };
+  int fd;
+  size_t depth;
+  std::mutex mut;
+  std::condition_variable cv;
+  std::deque<request> requests;
+  bool busy = false;
+  bool stopping = false;
+  std::thread worker;
+
+  void run() {
+    std::unique_lock lock(mut);
+    while (true) {
+      cv.wait(lock, [this]() { return !requests.empty() || stopping; });
+      if (requests.empty()) return;
+      auto req = std::move(requests.front());
+      requests.pop_front();
+      busy = true;
+      lock.unlock();
+      size_t n = 0;
+      completed(pwrite_all(fd, to_iovecs(req.slices), 0, req.offset, n), n);
+      lock.lock();
+      busy = false;
+      cv.notify_all();
+    }
+  }
+
+public:
+  thread_writer(int fd, size_t depth) : fd(fd), depth(std::max(depth, size_t(1))), worker([this]() { run(); }) {}
+
+  ~thread_writer() override {
+    {
+      std::scoped_lock lock(mut);
+      stopping = true;
+    }
+    cv.notify_all();
+    worker.join();
+  }
+
+  void write(std::vector<buffer_slice> slices, size_t offset) override {
+    std::unique_lock lock(mut);
+    cv.wait(lock, [this]() { return requests.size() < depth; });
+    requests.push_back(request{std::move(slices), offset});
+    cv.notify_all();
+  }
+
+  void wait() override {
+    std::unique_lock lock(mut);
+    cv.wait(lock, [this]() { return requests.empty() && !busy; });
+  }
+};
+
+#ifdef PIPER_HAVE_IO_URING
+/**
+ * Minimal io_uring writer on top of the raw system calls (no liburing dependency).
+ * Only used from the sink node thread, so no locking is needed.
+ */
+class io_uring_writer : public file_writer {
+private:
+  struct request {
+    std::vector<buffer_slice> slices;
+    std::vector<iovec> iov;
+    size_t offset;
+  };
+  int fd;
+  int ring_fd = -1;
+  unsigned entries = 0;
+  void *sq_ptr = MAP_FAILED;
+  size_t sq_len = 0;
+  void *cq_ptr = MAP_FAILED;
+  size_t cq_len = 0;
+  void *sqe_ptr = MAP_FAILED;
+  size_t sqe_len = 0;
+  unsigned *sq_head = nullptr;
+  unsigned *sq_tail = nullptr;
+  unsigned *sq_mask = nullptr;
+  unsigned *sq_array = nullptr;
+  unsigned *cq_head = nullptr;
+  unsigned *cq_tail = nullptr;
+  unsigned *cq_mask = nullptr;
+  io_uring_sqe *sqes = nullptr;
+  io_uring_cqe *cqes = nullptr;
+  std::vector<std::unique_ptr<request>> in_flight;
+
+  int enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    int ret;
+    do {
+      ret = int(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+  }
+
+  void reap(bool wait) {
+    if (wait) {
+      enter(0, 1, IORING_ENTER_GETEVENTS);
+    }
+    auto head = *cq_head;
+    while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+      const auto &cqe = cqes[head & *cq_mask];
+      auto *req = reinterpret_cast<request *>(cqe.user_data);
+      // short or failed writes are completed synchronously
+      size_t n = 0;
+      bool ok;
+      if (cqe.res < 0) {
+        ok = pwrite_all(fd, std::move(req->iov), 0, req->offset, n);
+      } else {
+        const auto i = advance(req->iov, 0, size_t(cqe.res));
+        n = size_t(cqe.res);
+        ok = pwrite_all(fd, std::move(req->iov), i, req->offset + cqe.res, n);
+      }
+      completed(ok, n);
+      in_flight.erase(std::find_if(
+          in_flight.begin(), in_flight.end(), [req](const auto &ptr) { return ptr.get() == req; }));
+      head++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  void submit(std::unique_ptr<request> req) {
+    while (in_flight.size() >= entries) {
+      reap(true);
+    }
+    const auto tail = *sq_tail;
+    const auto index = tail & *sq_mask;
+    auto &sqe = sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_WRITEV;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(req->iov.data());
+    sqe.len = unsigned(req->iov.size());
+    sqe.off = req->offset;
+    sqe.user_data = reinterpret_cast<uint64_t>(req.get());
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    if (enter(1, 0, 0) < 0 && __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == tail) {
+      // the kernel refused the submission without consuming the entry, take it back and write it ourselves
+      __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+      size_t n = 0;
+      completed(pwrite_all(fd, std::move(req->iov), 0, req->offset, n), n);
+    } else {
+      // a consumed entry completes with a cqe, which refers to the request
+      in_flight.push_back(std::move(req));
+    }
+    reap(false);
+  }
+
+public:
+  io_uring_writer(int fd, unsigned depth) : fd(fd) {
+    io_uring_params p{};
+    ring_fd = int(syscall(__NR_io_uring_setup, std::max(depth, 1u), &p));
+    if (ring_fd < 0) return;
+    entries = p.sq_entries;
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+      sq_len = cq_len = std::max(sq_len, cq_len);
+    }
+    sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) return;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+      cq_ptr = sq_ptr;
+    } else {
+      cq_ptr = mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+      if (cq_ptr == MAP_FAILED) return;
+    }
+    sqe_len = p.sq_entries * sizeof(io_uring_sqe);
+    sqe_ptr = mmap(nullptr, sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqe_ptr == MAP_FAILED) return;
+
+    auto *sq = static_cast<char *>(sq_ptr);
+    auto *cq = static_cast<char *>(cq_ptr);
+    sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+    sqes = static_cast<io_uring_sqe *>(sqe_ptr);
+  }
+
+  ~io_uring_writer() override {
+    if (ready()) wait();
+    if (sqe_ptr != MAP_FAILED) munmap(sqe_ptr, sqe_len);
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_len);
+    if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_len);
+    if (ring_fd >= 0) close(ring_fd);
+  }
+
+  bool ready() const {
+    return sqes != nullptr;
+  }
+
+  void write(std::vector<buffer_slice> slices, size_t offset) override {
+    // a single writev is limited to IOV_MAX vectors
+    for (size_t i = 0; i < slices.size(); i += IOV_MAX) {
+      auto req = std::make_unique<request>();
+      const auto end = std::min(slices.size(), i + IOV_MAX);
+      req->slices.assign(std::make_move_iterator(slices.begin() + i), std::make_move_iterator(slices.begin() + end));
+      req->iov = to_iovecs(req->slices);
+      req->offset = offset;
+      for (const auto &s : req->slices) offset += s.size();
+      submit(std::move(req));
+    }
+  }
+
+  void wait() override {
+    while (!in_flight.empty()) {
+      reap(true);
+    }
+  }
+};
+#endif
+}  // namespace
+
+file_source::file_source(const std::string &filename, file_source_options options) : options(options) {
+  // empty chunks would never get the source to the end of the file
+  if (options.mode == split_mode::fixed_size && options.chunk_size == 0) {
+    eof = true;
+    return;
+  }
+  if (options.use_mmap) {
+    if (auto mapped = buffer_slice::map_file(filename)) {
+      block = *mapped;
+      eof = true;
+      is_open_ = true;
+      if (!block.empty()) madvise(block.mutable_data(), block.size(), MADV_SEQUENTIAL);
+      return;
+    }
+  }
+  fd = open(filename.c_str(), O_RDONLY);
+  is_open_ = fd != -1;
+  eof = !is_open_;
+  if (is_open_) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+}
+
+file_source::~file_source() {
+  if (fd != -1) close(fd);
+}
+
+bool file_source::is_open() const {
+  return is_open_;
+}
+
+bool file_source::refill() {
+  if (eof) {
+    return false;
+  }
+  const size_t carry = block.size() - pos;
+  const size_t needed = options.mode == split_mode::fixed_size ? options.chunk_size : 0;
+  // grow the block when a record does not fit in it
+  const size_t size = std::max(options.readahead, carry + std::max(needed, carry));
+  auto fresh = buffer_slice::allocate(size);
+  if (carry > 0) {
+    std::memcpy(fresh.mutable_data(), block.data() + pos, carry);
+  }
+  size_t filled = carry;
+  while (filled < size) {
+    const auto n = read(fd, fresh.mutable_data() + filled, size - filled);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      eof = true;
+      break;
+    }
+    filled += n;
+  }
+  block = fresh.slice(0, filled);
+  pos = 0;
+  return filled > carry || eof;
+}
+
+std::shared_ptr<buffer_message> file_source::next() {
+  if (!is_open_) {
+    return nullptr;
+  }
+  while (true) {
+    const size_t remaining = block.size() - pos;
+    if (options.mode == split_mode::fixed_size) {
+      if (remaining >= options.chunk_size || (eof && remaining > 0)) {
+        const auto len = std::min(options.chunk_size, remaining);
+        auto ret = std::make_shared<buffer_message>(block.slice(pos, len));
+        pos += len;
+        bytes_read_ += len;
+        return ret;
+      }
+    } else {
+      const char delimiter = options.mode == split_mode::lines ? '\n' : options.delimiter;
+      const auto *begin = block.data() + pos;
+      const auto *found = remaining > 0 ? static_cast<const char *>(std::memchr(begin, delimiter, remaining)) : nullptr;
+      if (found) {
+        const size_t len = found - begin;
+        auto ret = std::make_shared<buffer_message>(block.slice(pos, len));
+        pos += len + 1;
+        bytes_read_ += len + 1;
+        return ret;
+      }
+      if (eof && remaining > 0) {
+        auto ret = std::make_shared<buffer_message>(block.slice(pos, remaining));
+        pos += remaining;
+        bytes_read_ += remaining;
+        return ret;
+      }
+    }
+    if (!refill()) {
+      return nullptr;
+    }
+  }
+}
+
+size_t file_source::bytes_read() const {
+  return bytes_read_;
+}
+
+file_sink::file_sink(const std::string &filename, file_sink_options options) : options(options) {
+  const auto flags = O_WRONLY | O_CREAT | (options.append ? O_APPEND : O_TRUNC);
+  fd = open(filename.c_str(), flags, 0644);
+  if (fd == -1) {
+    return;
+  }
+  if (options.append) {
+    offset = lseek(fd, 0, SEEK_END);
+  }
+#ifdef PIPER_HAVE_IO_URING
+  // O_APPEND ignores the offsets io_uring writes at, so appends go through the pwrite thread
+  if (options.use_io_uring && !options.append) {
+    auto uring = std::make_unique<io_uring_writer>(fd, unsigned(options.queue_depth));
+    if (uring->ready()) {
+      writer = std::move(uring);
+      return;
+    }
+  }
+#endif
+  writer = std::make_unique<thread_writer>(fd, options.queue_depth);
+}
+
+file_sink::~file_sink() {
+  if (fd == -1) {
+    return;
+  }
+  flush(clock::time_point::max());
+  writer.reset();
+  close(fd);
+}
+
+bool file_sink::is_open() const {
+  return fd != -1;
+}
+
+bool file_sink::uses_io_uring() const {
+#ifdef PIPER_HAVE_IO_URING
+  return dynamic_cast<io_uring_writer *>(writer.get()) != nullptr;
+#else
+  return false;
+#endif
+}
+
+void file_sink::write(const buffer_message &msg) {
+  if (fd == -1 || writer->errors() > 0) {
+    return;
+  }
+  if (batch.empty()) {
+    first_batched = clock::now();
+  }
+  batch.push_back(msg.payload);
+  batched_bytes += msg.payload.size();
+  if (options.delimiter) {
+    static const std::string delimiters = [] {
+      std::string s(256, '\0');
+      for (int i = 0; i < 256; i++) s[i] = char(i);
+      return s;
+    }();
+    const auto c = static_cast<unsigned char>(*options.delimiter);
+    batch.emplace_back(nullptr, const_cast<char *>(delimiters.data()) + c, 1);
+    batched_bytes++;
+  }
+  if (batched_bytes >= options.batch_bytes) {
+    flush(clock::now());
+  }
+}
+
+void file_sink::flush(clock::time_point now) {
+  if (fd == -1) {
+    return;
+  }
+  const bool everything = now == clock::time_point::max();
+  if (writer->errors() > 0) {
+    // a batch that failed leaves a hole, writing anything after it would only hide that
+    batch.clear();
+    batched_bytes = 0;
+  }
+  if (!batch.empty() && (everything || batched_bytes >= options.batch_bytes || now - first_batched >= options.linger)) {
+    writer->write(std::move(batch), offset);
+    offset += batched_bytes;
+    batch.clear();
+    batched_bytes = 0;
+  }
+  if (everything) {
+    writer->wait();
+  }
+}
+
+std::optional<file_sink::clock::time_point> file_sink::deadline() const {
+  if (batch.empty()) {
+    return std::nullopt;
+  }
+  return first_batched + options.linger;
+}
+
+size_t file_sink::bytes_written() const {
+  return writer ? writer->written() : 0;
+}
+
+size_t file_sink::errors() const {
+  return writer ? writer->errors() : 0;
+}
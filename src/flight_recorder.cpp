@@ -0,0 +1,141 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "flight_recorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+
+#include "stats.h"
+
+namespace {
+// only touched by the signal handler and read by the recorders, which do the actual dumping
+std::atomic<uint64_t> dump_signals = 0;
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+extern "C" void request_dump(int) {
+  dump_signals.fetch_add(1, std::memory_order_relaxed);
+}
+}  // namespace
+
+flight_recorder::flight_recorder(const stats &s, flight_recorder_options options)
+    : stats_(s),
+      options_{std::max(options.interval, std::chrono::milliseconds(1)), options.history},
+      frames_(std::max<size_t>(options_.history / options_.interval, 1)),
+      runner_(std::bind(&flight_recorder::run, this)) {}
+
+flight_recorder::~flight_recorder() {
+  {
+    std::scoped_lock lock(mut_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  runner_.join();
+}
+
+void flight_recorder::run() {
+  std::unique_lock lock(mut_);
+  auto next = clock::now();
+  while (!stopping_) {
+    // a late tick is not made up for, the frame timestamps show the gap
+    next = std::max(next + options_.interval, clock::now());
+    if (cv_.wait_until(lock, next, [this]() { return stopping_; })) {
+      break;
+    }
+    sample_unprotected();
+    if (const auto signals = dump_signals.load(std::memory_order_relaxed); signals != signals_seen_) {
+      signals_seen_ = signals;
+      if (!signal_filename_.empty()) {
+        std::ofstream ofs(signal_filename_);
+        dump_unprotected(ofs, std::chrono::milliseconds::max());
+      }
+    }
+  }
+}
+
+void flight_recorder::sample_unprotected() {
+  auto &f = frames_[head_ % frames_.size()];
+  f.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - epoch_).count();
+  f.in_flight_bytes = stats_.get_memory().in_flight_bytes;
+  // keeps its capacity, so frames that were used before don't allocate
+  f.entries.clear();
+  stats_.visit([&](const std::string &name, const stats::node_stats &s) {
+    auto found = name_index_.find(name);
+    if (found == name_index_.end()) {
+      found = name_index_.emplace(name, uint32_t(names_.size())).first;
+      names_.push_back(name);
+    }
+    uint8_t flags = 0;
+    if (s.is_storage) flags |= is_storage;
+    if (s.active) flags |= active;
+    if (s.is_sleeping_until_not_full) flags |= sleeping_until_not_full;
+    if (s.is_sleeping_until_not_empty) flags |= sleeping_until_not_empty;
+    f.entries.push_back(entry{found->second, flags, s.size, s.counter, s.is_storage ? s.bytes : s.bytes_counter});
+  });
+  head_++;
+}
+
+void flight_recorder::dump(std::ostream &os, std::chrono::milliseconds last) {
+  std::scoped_lock lock(mut_);
+  dump_unprotected(os, last);
+}
+
+bool flight_recorder::dump(const std::string &filename, std::chrono::milliseconds last) {
+  std::ofstream ofs(filename);
+  if (!ofs) {
+    return false;
+  }
+  dump(ofs, last);
+  return ofs.good();
+}
+
+void flight_recorder::dump_on_signal(std::string filename, int signal) {
+  {
+    std::scoped_lock lock(mut_);
+    signal_filename_ = std::move(filename);
+    signals_seen_ = dump_signals.load();
+  }
+  std::signal(signal, request_dump);
+}
+
+void flight_recorder::dump_unprotected(std::ostream &os, std::chrono::milliseconds last) {
+  const uint64_t count = std::min<uint64_t>(head_, frames_.size());
+  const int64_t newest_ns = count ? frames_[(head_ - 1) % frames_.size()].time_ns : 0;
+  const int64_t last_ns = last == std::chrono::milliseconds::max()
+                              ? std::numeric_limits<int64_t>::max()
+                              : std::chrono::duration_cast<std::chrono::nanoseconds>(last).count();
+  const auto flags = os.flags();
+  os << std::fixed << std::setprecision(3);
+  os << R"({"interval_ms":)" << options_.interval.count() << R"(,"names":[)";
+  for (size_t i = 0; i < names_.size(); i++) {
+    os << (i ? "," : "") << std::quoted(names_[i]);
+  }
+  // entries are [name, flags, size, counter, bytes], size and bytes are what a queue holds, the
+  // counter and bytes of a node are cumulative
+  os << R"(],"flags":{"storage":1,"active":2,"sleeping_until_not_full":4,"sleeping_until_not_empty":8},)"
+     << R"("frames":[)";
+  bool first = true;
+  for (auto i = head_ - count; i < head_; i++) {
+    const auto &f = frames_[i % frames_.size()];
+    if (newest_ns - f.time_ns > last_ns) {
+      continue;
+    }
+    os << (first ? "\n" : ",\n") << R"({"t_ms":)" << f.time_ns / 1e6 << R"(,"in_flight_bytes":)" << f.in_flight_bytes
+       << R"(,"entries":[)";
+    first = false;
+    for (size_t j = 0; j < f.entries.size(); j++) {
+      const auto &e = f.entries[j];
+      os << (j ? ",[" : "[") << e.name << "," << int(e.flags) << "," << e.size << "," << e.counter << "," << e.bytes
+         << "]";
+    }
+    os << "]}";
+  }
+  os << "\n]}\n";
+  os.flags(flags);
+}
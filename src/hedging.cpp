@@ -0,0 +1,94 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "hedging.h"
+
+#include <algorithm>
+
+hedge_group::hedge_group(hedging_options options) : options_(options) {
+  options_.percentile = std::clamp(options_.percentile, 0.0, 1.0);
+  samples_.reserve(sample_count);
+}
+
+std::shared_ptr<hedge_group::attempt> hedge_group::begin(std::shared_ptr<message_type> message) {
+  auto ret = std::make_shared<attempt>();
+  ret->message = std::move(message);
+  ret->started = clock::now();
+  messages_++;
+  std::scoped_lock lock(mut_);
+  in_flight_.push_back(ret);
+  return ret;
+}
+
+std::shared_ptr<hedge_group::attempt> hedge_group::hedge(clock::time_point now) {
+  const auto threshold = std::chrono::nanoseconds(threshold_ns_.load());
+  if (threshold.count() == 0) {
+    return nullptr;
+  }
+  std::scoped_lock lock(mut_);
+  for (const auto &a : in_flight_) {
+    if (now - a->started < threshold) {
+      // the rest started even later
+      break;
+    }
+    if (!a->hedged) {
+      a->hedged = true;
+      hedged_++;
+      return a;
+    }
+  }
+  return nullptr;
+}
+
+bool hedge_group::finish(attempt &a, clock::time_point started, bool is_hedge) {
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - started).count();
+  std::scoped_lock lock(mut_);
+  // the loser's time counts too, a straggler beaten by its duplicate still says how slow the stage is
+  add_sample_unprotected(ns);
+  if (a.finished) {
+    return false;
+  }
+  a.finished = true;
+  in_flight_.remove_if([&a](const auto &other) { return other.get() == &a; });
+  if (is_hedge) wins_++;
+  return true;
+}
+
+void hedge_group::add_sample_unprotected(int64_t ns) {
+  if (samples_.size() < sample_count) {
+    samples_.push_back(ns);
+  } else {
+    samples_[samples_taken_ % sample_count] = ns;
+  }
+  samples_taken_++;
+  if (samples_taken_ < options_.warmup || samples_taken_ % resample_every != 0) {
+    return;
+  }
+  auto sorted = samples_;
+  const auto nth = sorted.begin() + std::min(size_t(options_.percentile * sorted.size()), sorted.size() - 1);
+  std::nth_element(sorted.begin(), nth, sorted.end());
+  const int64_t min_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(options_.min_delay).count();
+  threshold_ns_ = std::max(*nth, std::max(min_ns, int64_t(1)));
+}
+
+std::optional<hedge_group::clock::time_point> hedge_group::next_check(clock::time_point now) const {
+  const auto threshold = std::chrono::nanoseconds(threshold_ns_.load());
+  if (threshold.count() == 0) {
+    return std::nullopt;
+  }
+  std::scoped_lock lock(mut_);
+  for (const auto &a : in_flight_) {
+    if (!a->hedged) {
+      return std::max(now, a->started + threshold);
+    }
+  }
+  // nothing left to hedge, a message arriving wakes the worker anyway
+  return std::nullopt;
+}
+
+hedging_stats hedge_group::read() const {
+  return {messages_.load(), hedged_.load(), wins_.load(), threshold_ns_.load()};
+}
@@ -7,30 +7,69 @@
 #include "node.h"
 #include "pipeline_system.h"
 #include "queue.h"
+#include "util/affinity.hpp"
 #include "util/threadname.hpp"
 
+#include <algorithm>
+
 static int global_counter = 1;
 
 node::node(pipeline_system& sys) : node("", sys) {}
 
 node::node(const std::string& name, pipeline_system& sys)
-    : system(sys), name_(name), runner(std::bind(&node::run, this)) {
+    : system(sys),
+      name_(name.empty() ? name : sys.replica_name(name)),
+      cpu_(sys.replica_cpu()) {
   sys.link(this);
-  sys.stats_.set_type(name, false);
+  sys.stats_.set_type(name_, false);
 }
 
-std::string node::name() {
+std::string node::name() const {
   return name_;
 }
 
+int64_t node::id() const {
+  return id_;
+}
+
 bool node::active() {
   return active_;
 }
 
+bool node::stopped() const {
+  return stopped_;
+}
+
 std::optional<transform_type> node::get_transform_type() {
   return transform_type_;
 }
 
+std::shared_ptr<queue> node::get_input_queue() {
+  return input_queue;
+}
+
+std::shared_ptr<queue> node::get_output_queue() {
+  return output_queue;
+}
+
+const std::vector<std::shared_ptr<queue>> &node::get_routed_queues() {
+  return routed_queues;
+}
+
+std::vector<std::shared_ptr<queue>> node::get_output_queues() {
+  if (!routed_queues.empty()) {
+    return routed_queues;
+  }
+  if (output_queue) {
+    return {output_queue};
+  }
+  return {};
+}
+
+std::optional<int> node::cpu() {
+  return cpu_;
+}
+
 void node::set_id(int64_t id) {
   this->id_ = id;
 }
@@ -46,7 +85,6 @@ void node::init() {
     }
     global_counter++;
   }
-  set_thread_name(name_);
 }
 
 void node::set_input_queue(std::shared_ptr<queue> ptr) {
@@ -63,51 +101,102 @@ void node::set_transform_type(transform_type tt) {
   transform_type_ = tt;
 }
 
+void node::start() {
+  runner = std::thread(std::bind(&node::run, this));
+}
+
 void node::run() {
   set_thread_name(name_);
+  if (cpu_) {
+    pin_thread_to_cpu(*cpu_);
+  }
+  if (system.perf_counters_enabled) {
+    if (auto counters = perf_counters::open_for_current_thread()) {
+      system.stats_.set_perf_counters(name_, std::move(counters));
+    }
+  }
   system.sleep();
+  if (input_queue && output_queue && input_queue->hedging && !flat_map_fun &&
+      transform_type_.value_or(transform_type::same_pool) == transform_type::same_pool) {
+    hedge_ = input_queue->hedging;
+  }
+  system.stats_.set_started(name_, clock::now());
   while (system.active() && active_) {
+    acquire_slot();
     // producer
     if (!input_queue && output_queue) {
-      while (!output_queue->is_full() && active_) {
+      // routed producers block per output in route(), so they only stop for the system
+      while (active_ && (route_fun ? system.active() : !output_queue->is_full())) {
+        if (system.draining) {
+          deactivate();
+          break;
+        }
+        if (system.memory_budget > 0) {
+          sleep_until_within_memory_budget();
+        }
+        yield_slot();
         std::shared_ptr<message_type> ret = produce();
         if (ret) {
-          output_queue->push(std::move(ret));
+          if (route_fun) {
+            route(std::move(ret));
+          } else if (output_queue->lanes.size() > 1) {
+            push(std::move(ret));
+          } else {
+            output_queue->push(std::move(ret));
+          }
         } else {
           deactivate();
           break;
         }
       }
-      if (active_) {
+      if (active_ && !route_fun) {
         sleep_until_not_full();
       }
     }
     // transformer
     else if (input_queue && output_queue) {
       sleep_until_items_available();
-      while (input_queue->has_items(id_)) {
+      while (system.active() && input_queue->has_items(id_)) {
         if (auto ret = input_queue->pop(id_)) {
-          auto transformed = transform(std::move(ret));
-          sleep_until_not_full();
-          output_queue->push(std::move(transformed));
+          if (flat_map_fun) {
+            push_all(flat_map(std::move(ret)));
+          } else if (hedge_) {
+            push(transform(*hedge_->begin(std::move(ret)), false));
+          } else {
+            push(transform(std::move(ret)));
+          }
         }
+        if (flush_fun) flush(clock::now());
+        yield_slot();
       }
+      if (flush_fun) flush(clock::now());
+      if (hedge_) hedge_stragglers();
+      handle_markers();
       if (!input_queue->active) {
+        flush(clock::time_point::max());
         deactivate();
       }
     }
     // consumer
     else if (input_queue && !output_queue) {
       sleep_until_items_available();
-      while (input_queue->has_items(id_)) {
+      while (system.active() && input_queue->has_items(id_)) {
         auto ret2 = input_queue->pop(id_);
         consume(std::move(ret2));
+        yield_slot();
       }
+      if (flush_fun) flush(clock::now());
+      handle_markers();
       if (!input_queue->active) {
+        flush(clock::time_point::max());
         deactivate();
       }
     }
   }
+  release_slot();
+  system.stats_.set_stopped(name_, clock::now());
+  stopped_ = true;
+  system.node_stopped();
 }
 
 void node::set_produce_function(produce_fun_t fun) {
@@ -122,39 +211,292 @@ void node::set_consume_function(consume_fun_t fun) {
   consume_fun = std::move(fun);
 }
 
+void node::set_marker_function(marker_fun_t fun) {
+  marker_fun = std::move(fun);
+}
+
+void node::set_flat_map_function(flat_map_fun_t fun) {
+  flat_map_fun = std::move(fun);
+}
+
+void node::set_flush_function(flush_fun_t fun, deadline_fun_t deadline) {
+  flush_fun = std::move(fun);
+  deadline_fun = std::move(deadline);
+}
+
+void node::set_route_function(route_fun_t fun, std::vector<std::shared_ptr<queue>> outputs) {
+  route_fun = std::move(fun);
+  routed_queues = std::move(outputs);
+  set_output_queue(routed_queues.front());
+  for (size_t i = 1; i < routed_queues.size(); i++) {
+    routed_queues[i]->set_provider(this);
+  }
+}
+
 std::shared_ptr<message_type> node::produce() {
   system.stats_.add_counter(name_);
-  return produce_fun();
+  if (!system.tracer_.enabled()) {
+    auto ret = produce_fun();
+    // produce functions that block, such as a job runner's source, give their slot back meanwhile
+    acquire_slot();
+    return ret;
+  }
+  const auto begin = clock::now();
+  auto ret = produce_fun();
+  trace(trace_kind::produce, begin, clock::now());
+  acquire_slot();
+  return ret;
 }
 
 std::shared_ptr<message_type> node::transform(std::shared_ptr<message_type> item) {
   system.stats_.add_counter(name_);
-  return transform_fun(std::move(item));
+  return transform_uncounted(std::move(item));
+}
+
+std::shared_ptr<message_type> node::transform_uncounted(std::shared_ptr<message_type> item) {
+  const auto *hooks = process_hooks();
+  if (!system.tracer_.enabled() && !hooks) {
+    return transform_fun(std::move(item));
+  }
+  const auto begin = clock::now();
+  // keeps the message alive for on_process_end()
+  const auto in = hooks ? item : nullptr;
+  if (in) hooks->on_process_begin(*this, *in);
+  auto ret = transform_fun(std::move(item));
+  const auto end = clock::now();
+  if (in) hooks->on_process_end(*this, *in, end - begin);
+  trace(trace_kind::transform, begin, end);
+  return ret;
+}
+
+std::shared_ptr<message_type> node::transform(hedge_group::attempt &attempt, bool is_hedge) {
+  const auto begin = clock::now();
+  auto ret = is_hedge ? transform_uncounted(attempt.message) : transform(attempt.message);
+  return hedge_->finish(attempt, begin, is_hedge) ? ret : nullptr;
+}
+
+void node::hedge_stragglers() {
+  while (system.active() && !input_queue->has_items(id_)) {
+    auto attempt = hedge_->hedge(clock::now());
+    if (!attempt) {
+      return;
+    }
+    push(transform(*attempt, true));
+  }
 }
 
 void node::consume(std::shared_ptr<message_type> item) {
   system.stats_.add_counter(name_);
-  return consume_fun(std::move(item));
+  const auto *hooks = process_hooks();
+  if (!system.tracer_.enabled() && !hooks) {
+    return consume_fun(std::move(item));
+  }
+  const auto begin = clock::now();
+  const auto in = hooks ? item : nullptr;
+  if (in) hooks->on_process_begin(*this, *in);
+  consume_fun(std::move(item));
+  const auto end = clock::now();
+  if (in) hooks->on_process_end(*this, *in, end - begin);
+  trace(trace_kind::consume, begin, end);
+}
+
+std::vector<std::shared_ptr<message_type>> node::flat_map(std::shared_ptr<message_type> item) {
+  system.stats_.add_counter(name_);
+  const auto *hooks = process_hooks();
+  if (!system.tracer_.enabled() && !hooks) {
+    return flat_map_fun(std::move(item));
+  }
+  const auto begin = clock::now();
+  const auto in = hooks ? item : nullptr;
+  if (in) hooks->on_process_begin(*this, *in);
+  auto ret = flat_map_fun(std::move(item));
+  const auto end = clock::now();
+  if (in) hooks->on_process_end(*this, *in, end - begin);
+  trace(trace_kind::transform, begin, end);
+  return ret;
+}
+
+void node::flush(clock::time_point now) {
+  if (!flush_fun) {
+    return;
+  }
+  push_all(flush_fun(now));
+}
+
+void node::push(std::shared_ptr<message_type> item) {
+  // dropped messages, e.g. by filters, never reach the queue nor wake up its consumers
+  if (!item) {
+    return;
+  }
+  if (route_fun) {
+    route(std::move(item));
+    return;
+  }
+  const auto lane = output_queue->lane_of(item);
+  sleep_until_not_full(lane);
+  output_queue->push(std::move(item), lane);
+}
+
+void node::push_all(std::vector<std::shared_ptr<message_type>> items) {
+  items.erase(std::remove(items.begin(), items.end(), nullptr), items.end());
+  if (items.empty()) {
+    return;
+  }
+  // with priority lanes or several outputs every message has to respect the capacity of its own queue
+  if (route_fun || output_queue->lanes.size() > 1) {
+    for (auto &item : items) {
+      push(std::move(item));
+    }
+    return;
+  }
+  // the entire batch is pushed at once, this may exceed max_items by the size of the batch
+  sleep_until_not_full();
+  output_queue->push_all(std::move(items));
+}
+
+void node::route(std::shared_ptr<message_type> item) {
+  // only the chosen output applies back-pressure
+  auto &q = *routed_queues[route_fun(item) % routed_queues.size()];
+  const auto lane = q.lane_of(item);
+  sleep_until_not_full(q, lane);
+  q.push(std::move(item), lane);
+}
+
+void node::handle_markers() {
+  while (auto marker = input_queue->pop_marker(this)) {
+    // everything belonging to the job has to be flushed before the marker
+    flush(clock::time_point::max());
+    if (marker_fun) {
+      marker_fun(std::move(marker));
+    } else {
+      // routers follow every output with the marker, whichever of them the job's messages took
+      for (const auto &q : get_output_queues()) {
+        q->push_marker(marker);
+      }
+    }
+  }
 }
 
 void node::sleep_until_items_available() {
   system.stats_.set_sleep_until_not_empty(name_, true);
-  input_queue->sleep_until_items_available(id_);
+  auto deadline = deadline_fun ? deadline_fun() : std::nullopt;
+  // wakes up in time to duplicate the messages that become stragglers in the meantime
+  if (hedge_) {
+    if (const auto check = hedge_->next_check(clock::now()); check && (!deadline || *check < *deadline)) {
+      deadline = check;
+    }
+  }
+  const auto waited = deadline ? input_queue->sleep_until_items_available_until(id_, this, *deadline)
+                               : input_queue->sleep_until_items_available(id_, this);
+  // the clock is only read when the queue actually blocked
+  if (waited) {
+    const auto end = clock::now();
+    system.stats_.add_blocked_on_input(name_, end - *waited);
+    trace(trace_kind::wait_input, *waited, end);
+    trace(trace_kind::wakeup, end, end);
+  }
   system.stats_.set_sleep_until_not_empty(name_, false);
+  // the queue gave the slot back if it blocked, waiting for input is the natural moment to let other nodes run
+  acquire_slot();
+}
+
+void node::sleep_until_not_full(std::optional<size_t> lane) {
+  sleep_until_not_full(*output_queue, lane);
+}
+
+void node::sleep_until_not_full(queue &q, std::optional<size_t> lane) {
+  system.stats_.set_sleep_until_not_full(name_, true);
+  const auto waited = q.sleep_until_not_full(lane, this);
+  if (waited) {
+    const auto end = clock::now();
+    system.stats_.add_blocked_on_output(name_, end - *waited);
+    trace(trace_kind::wait_output, *waited, end);
+    trace(trace_kind::wakeup, end, end);
+  }
+  system.stats_.set_sleep_until_not_full(name_, false);
+  acquire_slot();
 }
 
-void node::sleep_until_not_full() {
+void node::sleep_until_within_memory_budget() {
   system.stats_.set_sleep_until_not_full(name_, true);
-  output_queue->sleep_until_not_full();
+  const auto waited = system.sleep_until_within_memory_budget(this);
+  if (waited) {
+    const auto end = clock::now();
+    system.stats_.add_blocked_on_output(name_, end - *waited);
+    trace(trace_kind::wait_output, *waited, end);
+    trace(trace_kind::wakeup, end, end);
+  }
   system.stats_.set_sleep_until_not_full(name_, false);
+  acquire_slot();
+}
+
+bool node::holding_slot() const {
+  return holding_slot_;
+}
+
+void node::acquire_slot() {
+  if (!system.scheduler || holding_slot_) {
+    return;
+  }
+  const auto begin = clock::now();
+  // a cancelled tenant runs its nodes without slots until they stop
+  holding_slot_ = system.scheduler->acquire(*system.tenant);
+  slot_acquired_ = clock::now();
+  // throttled, not blocked on a queue, so the analyzer doesn't count it as work either
+  system.stats_.add_throttled(name_, slot_acquired_ - begin);
+}
+
+void node::release_slot() {
+  if (!holding_slot_) {
+    return;
+  }
+  system.scheduler->release(*system.tenant, clock::now() - slot_acquired_);
+  holding_slot_ = false;
+}
+
+void node::yield_slot() {
+  if (!holding_slot_) {
+    return;
+  }
+  const auto now = clock::now();
+  if (system.scheduler->should_yield(now - slot_acquired_)) {
+    holding_slot_ = system.scheduler->yield(*system.tenant, now - slot_acquired_);
+    slot_acquired_ = clock::now();
+    system.stats_.add_throttled(name_, slot_acquired_ - now);
+  }
+}
+
+void node::trace(trace_kind kind, clock::time_point begin, clock::time_point end) {
+  if (!system.tracer_.enabled()) {
+    return;
+  }
+  // rings are allocated lazily by the node thread itself, so untraced pipelines don't pay for them
+  if (!trace_ring_) {
+    trace_ring_ = system.tracer_.register_thread(name_);
+  }
+  system.tracer_.record(*trace_ring_, kind, begin, end);
+}
+
+const instrumentation_hooks *node::process_hooks() const {
+  if constexpr (instrumentation_enabled) {
+    if (input_queue && input_queue->instrumentation && input_queue->instrumentation->observes_processing()) {
+      return input_queue->instrumentation.get();
+    }
+  }
+  return nullptr;
 }
 
 void node::deactivate() {
   system.stats_.set_active(name_, false);
   active_ = false;
-  if (output_queue) output_queue->check_terminate();
+  if (routed_queues.empty() && output_queue) output_queue->check_terminate();
+  for (const auto &q : routed_queues) {
+    q->check_terminate();
+  }
 }
 
 void node::join() {
-  runner.join();
+  if (runner.joinable()) {
+    runner.join();
+  }
 }
@@ -0,0 +1,132 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#endif
+
+perf_sample &perf_sample::operator+=(const perf_sample &other) {
+  hardware |= other.hardware;
+  cycles += other.cycles;
+  instructions += other.instructions;
+  cache_misses += other.cache_misses;
+  task_clock_ns += other.task_clock_ns;
+  context_switches += other.context_switches;
+  page_faults += other.page_faults;
+  return *this;
+}
+
+perf_sample perf_sample::operator-(const perf_sample &other) const {
+  // counters only go up, but the replicas summed up in a sample can differ between two reads
+  auto minus = [](uint64_t a, uint64_t b) { return a > b ? a - b : 0; };
+  perf_sample ret;
+  ret.hardware = hardware;
+  ret.cycles = minus(cycles, other.cycles);
+  ret.instructions = minus(instructions, other.instructions);
+  ret.cache_misses = minus(cache_misses, other.cache_misses);
+  ret.task_clock_ns = minus(task_clock_ns, other.task_clock_ns);
+  ret.context_switches = minus(context_switches, other.context_switches);
+  ret.page_faults = minus(page_faults, other.page_faults);
+  return ret;
+}
+
+#ifdef __linux__
+namespace {
+int open_event(uint32_t type, uint64_t config) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  // hardware counters are multiplexed when there are more events than registers, the times allow scaling
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.exclude_hv = 1;
+  // the kernel side matters too (context switches happen there), but may not be allowed to unprivileged users
+  for (int exclude_kernel = 0; exclude_kernel < 2; exclude_kernel++) {
+    attr.exclude_kernel = exclude_kernel;
+    const int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+    if (fd >= 0 || (errno != EACCES && errno != EPERM)) return fd;
+  }
+  return -1;
+}
+
+uint64_t read_event(int fd) {
+  if (fd < 0) return 0;
+  uint64_t values[3] = {};  // value, time enabled, time running
+  if (::read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) return 0;
+  if (values[2] < values[1]) {
+    return uint64_t(double(values[0]) * values[1] / values[2]);
+  }
+  return values[0];
+}
+}  // namespace
+
+perf_counters::perf_counters() {
+  fds_.fill(-1);
+}
+
+perf_counters::~perf_counters() {
+  for (const auto fd : fds_) {
+    if (fd >= 0) close(fd);
+  }
+}
+
+std::shared_ptr<perf_counters> perf_counters::open_for_current_thread() {
+  std::shared_ptr<perf_counters> ret(new perf_counters());
+  auto &fds = ret->fds_;
+  fds[task_clock] = open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+  if (fds[task_clock] < 0) return nullptr;
+  fds[context_switches] = open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+  fds[page_faults] = open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+  fds[cycles] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  if (fds[cycles] >= 0) {
+    fds[instructions] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds[cache_misses] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  }
+  return ret;
+}
+
+bool perf_counters::hardware() const {
+  return fds_[cycles] >= 0;
+}
+
+perf_sample perf_counters::read() const {
+  perf_sample ret;
+  ret.hardware = hardware();
+  ret.cycles = read_event(fds_[cycles]);
+  ret.instructions = read_event(fds_[instructions]);
+  ret.cache_misses = read_event(fds_[cache_misses]);
+  ret.task_clock_ns = read_event(fds_[task_clock]);
+  ret.context_switches = read_event(fds_[context_switches]);
+  ret.page_faults = read_event(fds_[page_faults]);
+  return ret;
+}
+#else
+perf_counters::perf_counters() {
+  fds_.fill(-1);
+}
+
+perf_counters::~perf_counters() = default;
+
+std::shared_ptr<perf_counters> perf_counters::open_for_current_thread() {
+  return nullptr;
+}
+
+bool perf_counters::hardware() const {
+  return false;
+}
+
+perf_sample perf_counters::read() const {
+  return {};
+}
+#endif
@@ -5,6 +5,7 @@
  */
 
 #include "pipeline_system.h"
+#include "bottleneck_analyzer.h"
 #include "node.h"
 
 #include <iostream>
@@ -14,11 +15,27 @@
 pipeline_system::pipeline_system() : pipeline_system(false) {}
 
 pipeline_system::pipeline_system(bool visualization_enabled)
-    : visualization_enabled(visualization_enabled), runner(std::bind(&pipeline_system::run, this)) {}
+    : visualization_enabled(visualization_enabled) {}
 
 pipeline_system::~pipeline_system() {
+  // node threads must not outlive the system, e.g. after start(false) without explicit_join()
+  bool running;
+  {
+    std::scoped_lock lock(mut);
+    running = started && stopped_nodes < nodes.size();
+  }
+  if (running) {
+    shutdown(std::chrono::steady_clock::now());
+  }
+  // the threads use the system, so nodes stuck in their function are still waited for here, without a bound
+  explicit_join();
   is_active = false;
-  runner.join();
+  if (runner.joinable()) {
+    runner.join();
+  }
+  if (scheduler) {
+    scheduler->remove_tenant(tenant);
+  }
 }
 
 void pipeline_system::sleep() {
@@ -39,9 +56,17 @@ void pipeline_system::link(node *n) {
 }
 
 void pipeline_system::start(bool auto_join_threads) {
+  // naming is cheap and needed by stats_.setup(), the rest of the initialization happens on the
+  // node threads themselves, in parallel with each other and with setup()
   for (const auto &node : nodes) {
     node->init();
   }
+  for (const auto &node : nodes) {
+    node->start();
+  }
+  if (visualization_enabled) {
+    runner = std::thread(std::bind(&pipeline_system::run, this));
+  }
   stats_.setup(containers);
   {
     std::scoped_lock<std::mutex> lock(mut);
@@ -54,21 +79,155 @@ void pipeline_system::start(bool auto_join_threads) {
   }
 }
 
+shutdown_report pipeline_system::shutdown(std::chrono::steady_clock::time_point deadline,
+                                          std::chrono::milliseconds grace) {
+  const auto begin = std::chrono::steady_clock::now();
+  shutdown_report report;
+  for (const auto &q : containers) {
+    report.in_flight += q->size();
+  }
+  stats_.set_shutdown_deadline(deadline);
+  // producers stop at their next message, or once the queue they are blocked on drains
+  draining = true;
+  for (const auto &hook : shutdown_hooks) {
+    hook();
+  }
+  std::unique_lock lock(mut);
+  const auto all_stopped = [this]() { return !started || stopped_nodes == nodes.size(); };
+  report.drained = cv.wait_until(lock, deadline, all_stopped);
+  if (!report.drained) {
+    lock.unlock();
+    // wakes up every node waiting on a queue or the memory budget, they see the system is no longer active
+    is_active = false;
+    for (const auto &q : containers) {
+      q->cancel();
+    }
+    {
+      std::scoped_lock memory_lock(memory_mut);
+    }
+    memory_cv.notify_all();
+    if (scheduler) {
+      scheduler->cancel(*tenant);
+    }
+    lock.lock();
+    if (!cv.wait_for(lock, grace, all_stopped)) {
+      for (const auto &node : nodes) {
+        if (!node->stopped()) {
+          report.stuck_nodes.push_back(node->name());
+        }
+      }
+    }
+  }
+  lock.unlock();
+  for (const auto &q : containers) {
+    if (const auto left = q->size()) {
+      report.undelivered += left;
+      report.undelivered_per_queue[q->name] = left;
+    }
+  }
+  report.elapsed = std::chrono::steady_clock::now() - begin;
+  return report;
+}
+
+shutdown_report pipeline_system::shutdown(std::chrono::milliseconds timeout, std::chrono::milliseconds grace) {
+  return shutdown(std::chrono::steady_clock::now() + timeout, grace);
+}
+
+void pipeline_system::node_stopped() {
+  {
+    std::scoped_lock lock(mut);
+    stopped_nodes++;
+  }
+  cv.notify_all();
+}
+
 void pipeline_system::explicit_join() {
   for (const auto &node : nodes) {
     node->join();
   }
 }
 
+void pipeline_system::replicate(size_t n, const std::function<void(size_t)> &builder, bool pin_threads) {
+  pin_replicas = pin_threads;
+  for (size_t i = 0; i < n; i++) {
+    building_replica = i;
+    builder(i);
+  }
+  building_replica = std::nullopt;
+}
+
+std::string pipeline_system::replica_name(const std::string &name) const {
+  if (!building_replica) {
+    return name;
+  }
+  return name + " #" + std::to_string(*building_replica);
+}
+
+std::optional<int> pipeline_system::replica_cpu() const {
+  if (!building_replica || !pin_replicas) {
+    return std::nullopt;
+  }
+  return int(*building_replica % std::max(std::thread::hardware_concurrency(), 1u));
+}
+
 void pipeline_system::run() {
   while (is_active && visualization_enabled) {
     std::this_thread::sleep_for(std::chrono::seconds(1));
     if (visualization_enabled) {
       stats_.display();
+      if (started) {
+        a(std::cout) << bottleneck_analyzer(*this).analyze().summary() << std::endl;
+      }
     }
   }
 }
 
+void pipeline_system::use_scheduler(std::shared_ptr<fair_scheduler> shared, std::string tenant_name, double weight) {
+  scheduler = std::move(shared);
+  tenant = scheduler->add_tenant(std::move(tenant_name), weight);
+  stats_.set_tenant(scheduler, tenant);
+}
+
+void pipeline_system::set_memory_budget(size_t bytes) {
+  {
+    std::scoped_lock lock(memory_mut);
+    memory_budget = bytes;
+  }
+  stats_.set_memory_budget(bytes);
+  memory_cv.notify_all();
+}
+
+void pipeline_system::acquire_memory(size_t bytes) {
+  stats_.add_in_flight_bytes(bytes);
+}
+
+void pipeline_system::release_memory(size_t bytes) {
+  const auto now = stats_.remove_in_flight_bytes(bytes);
+  // only wake up the producers when dropping below the budget
+  if (memory_budget > 0 && now < memory_budget && now + bytes >= memory_budget) {
+    std::scoped_lock lock(memory_mut);
+    memory_cv.notify_all();
+  }
+}
+
+std::optional<queue::clock::time_point> pipeline_system::sleep_until_within_memory_budget(node *waiter) {
+  std::unique_lock lock(memory_mut);
+  auto within = [this]() {
+    return memory_budget == 0 || stats_.get_memory().in_flight_bytes < memory_budget || !is_active;
+  };
+  if (within()) {
+    return std::nullopt;
+  }
+  if (waiter && waiter->holding_slot()) {
+    lock.unlock();
+    waiter->release_slot();
+    lock.lock();
+  }
+  const auto begin = queue::clock::now();
+  memory_cv.wait(lock, within);
+  return begin;
+}
+
 std::shared_ptr<queue> pipeline_system::create_queue(size_t max_items) {
   static int i = 1;
   std::string name = "storage " + std::to_string(i++);
@@ -76,12 +235,147 @@ std::shared_ptr<queue> pipeline_system::create_queue(size_t max_items) {
 }
 
 std::shared_ptr<queue> pipeline_system::create_queue(const std::string &name, size_t max_items) {
-  auto instance = std::make_shared<queue>(name, *this, max_items);
+  auto instance = std::make_shared<queue>(replica_name(name), *this, max_items);
+  link(instance);
+  stats_.set_type(instance->name, true);
+  return instance;
+}
+
+std::shared_ptr<queue> pipeline_system::create_queue(const std::string &name, size_t max_items, size_t max_bytes) {
+  auto instance = create_queue(name, max_items);
+  instance->max_bytes = max_bytes;
+  stats_.set_max_bytes(instance->name, max_bytes);
+  return instance;
+}
+
+std::shared_ptr<queue> pipeline_system::create_queue(const std::string &name,
+                                                    std::vector<lane_options> lanes,
+                                                    lane_policy policy) {
+  auto instance = std::make_shared<queue>(replica_name(name), *this, std::move(lanes), policy);
   link(instance);
-  stats_.set_type(name, true);
+  stats_.set_type(instance->name, true);
   return instance;
 }
 
+std::shared_ptr<queue> pipeline_system::create_queue(capacity_tuning tuning) {
+  static int i = 1;
+  std::string name = "auto storage " + std::to_string(i++);
+  return create_queue(name, tuning);
+}
+
+std::shared_ptr<queue> pipeline_system::create_queue(const std::string &name, capacity_tuning tuning) {
+  auto instance = std::make_shared<queue>(replica_name(name), *this, tuning);
+  link(instance);
+  stats_.set_type(instance->name, true);
+  return instance;
+}
+
+bool pipeline_system::spawn_file_source(std::string name,
+                                        const std::string &filename,
+                                        file_source_options options,
+                                        std::shared_ptr<queue> output) {
+  auto source = std::make_shared<file_source>(filename, options);
+  if (!source->is_open()) {
+    return false;
+  }
+  auto n = std::make_shared<node>(name, *this);
+  auto *raw = n.get();
+  size_t reported = 0;
+  n->set_produce_function([=]() mutable -> std::shared_ptr<message_type> {
+    auto msg = source->next();
+    // throughput is reported in steps, so the stats lock isn't taken for every line
+    if (!msg || source->bytes_read() - reported >= 1024 * 1024) {
+      stats_.add_bytes(raw->name(), source->bytes_read() - reported);
+      reported = source->bytes_read();
+    }
+    return msg;
+  });
+  n->set_output_queue(output);
+  spawned.push_back(n);
+  return true;
+}
+
+bool pipeline_system::spawn_file_sink(std::string name,
+                                      const std::string &filename,
+                                      file_sink_options options,
+                                      std::shared_ptr<queue> input) {
+  auto sink = std::make_shared<file_sink>(filename, options);
+  if (!sink->is_open()) {
+    return false;
+  }
+  auto n = std::make_shared<node>(name, *this);
+  auto *raw = n.get();
+  n->set_consume_function([=](std::shared_ptr<message_type> in) {
+    if (auto msg = std::dynamic_pointer_cast<buffer_message>(in)) {
+      sink->write(*msg);
+    }
+  });
+  size_t reported = 0;
+  size_t reported_errors = 0;
+  n->set_flush_function(
+      [=](auto now) mutable {
+        sink->flush(now);
+        if (sink->bytes_written() > reported) {
+          stats_.add_bytes(raw->name(), sink->bytes_written() - reported);
+          reported = sink->bytes_written();
+        }
+        if (sink->errors() > reported_errors) {
+          stats_.add_errors(raw->name(), sink->errors() - reported_errors);
+          reported_errors = sink->errors();
+        }
+        return std::vector<std::shared_ptr<message_type>>{};
+      },
+      [=]() { return sink->deadline(); });
+  n->set_input_queue(input);
+  spawned.push_back(n);
+  return true;
+}
+
+void pipeline_system::set_hedging(std::shared_ptr<queue> input, hedging_options options) {
+  input->hedging = std::make_shared<hedge_group>(options);
+  stats_.set_hedging(input->name, input->hedging);
+}
+
+std::shared_ptr<recorder> pipeline_system::record(std::shared_ptr<queue> q,
+                                                  const std::string &filename,
+                                                  serialize_fun_t serialize) {
+  auto instance = std::make_shared<recorder>(filename, std::move(serialize));
+  if (!instance->is_open()) {
+    return nullptr;
+  }
+  q->recording = instance;
+  return instance;
+}
+
+bool pipeline_system::spawn_replayer(std::string name,
+                                     const std::string &filename,
+                                     deserialize_fun_t deserialize,
+                                     replay_options options,
+                                     std::shared_ptr<queue> output) {
+  auto source = std::make_shared<replayer>(filename, std::move(deserialize), options);
+  if (!source->is_open()) {
+    return false;
+  }
+  auto n = std::make_shared<node>(name, *this);
+  n->set_produce_function([=]() { return source->next(); });
+  n->set_output_queue(output);
+  spawned.push_back(n);
+  return true;
+}
+
 const stats &pipeline_system::get_stats() const {
   return stats_;
 }
+
+tracer &pipeline_system::get_tracer() {
+  return tracer_;
+}
+
+flight_recorder &pipeline_system::enable_flight_recorder(flight_recorder_options options) {
+  flight_recorder_ = std::make_unique<flight_recorder>(stats_, options);
+  return *flight_recorder_;
+}
+
+flight_recorder *pipeline_system::get_flight_recorder() {
+  return flight_recorder_.get();
+}
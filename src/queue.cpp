@@ -4,14 +4,20 @@
   file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
+#include <algorithm>
 #include <sstream>
 #include <utility>
 
 #include "node.h"
 #include "pipeline_system.h"
 #include "queue.h"
+#include "recording.h"
 
 void queue::set_consumer(node *node_ptr, int id) {
+  // id 0 is only a placeholder until the first consumer registers
+  if (consumer_ptrs.empty()) {
+    consumer_ids.clear();
+  }
   consumer_ids.insert(id);
   consumer_ptrs.push_back(node_ptr);
 }
@@ -20,36 +26,184 @@ void queue::set_provider(node *node_ptr) {
   provider_ptrs.push_back(node_ptr);
 }
 
+namespace {
+auto find_item(std::deque<queue::item> &items, int id) {
+  return std::find_if(
+      items.begin(), items.end(), [&id](const auto &item) { return item.consumers.find(id) != item.consumers.end(); });
+}
+}  // namespace
+
 queue::queue(std::string name, pipeline_system &sys, int max_items)
-    : name(std::move(name)), system(sys), max_items(max_items) {}
+    : lanes(1, lane{{}, size_t(max_items), 1}), name(std::move(name)), system(sys), max_items(max_items) {}
+
+queue::queue(std::string name, pipeline_system &sys, std::vector<lane_options> options, lane_policy policy)
+    : policy(policy), name(std::move(name)), system(sys), max_items(0) {
+  for (const auto &opt : options) {
+    lanes.push_back(lane{{}, opt.max_items, std::max(opt.weight, size_t(1))});
+    max_items += opt.max_items;
+  }
+  if (lanes.empty()) {
+    lanes.push_back(lane{{}, max_items, 1});
+  }
+}
+
+queue::queue(std::string name, pipeline_system &sys, capacity_tuning options)
+    : name(std::move(name)), system(sys) {
+  // a capacity of 0 blocks every provider for good, and std::clamp() needs min_items <= max_items
+  options.min_items = std::max(options.min_items, size_t(1));
+  options.max_items = std::max(options.max_items, options.min_items);
+  tuning = options;
+  max_items = std::clamp(max_items, tuning->min_items, tuning->max_items);
+  lanes.push_back(lane{{}, max_items, 1});
+  window.started = clock::now();
+  system.stats_.set_capacity(this->name, max_items);
+}
 
-void queue::sleep_until_not_full() {
+std::optional<queue::clock::time_point> queue::sleep_until_not_full(std::optional<size_t> lane, node *waiter) {
   std::unique_lock lock(items_mut);
-  if (items.size() < max_items) {
-    return;
+  if (!is_full_unprotected(lane)) {
+    return std::nullopt;
   }
   if (!active) {
-    return;
+    return std::nullopt;
   }
-  cv.wait(lock, [this]() { return !is_full_unprotected() || !active; });
+  release_slot_unprotected(lock, waiter);
+  const auto begin = clock::now();
+  wait_begin_unprotected(lock, wait_kind::not_full);
+  cv.wait(lock, [this, lane]() { return !is_full_unprotected(lane) || !active; });
+  if (tuning) {
+    window.blocked_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - begin).count();
+  }
+  wait_end_unprotected(lock, wait_kind::not_full, begin);
+  return begin;
 }
 
-void queue::sleep_until_items_available(int id) {
+std::optional<queue::clock::time_point> queue::sleep_until_items_available(int id, node *consumer) {
   std::unique_lock lock(items_mut);
-  if (has_items_unprotected(id)) {
-    return;
+  if (has_items_unprotected(id) || has_marker_unprotected(consumer)) {
+    return std::nullopt;
   }
   if (!active) {
-    return;
+    return std::nullopt;
+  }
+  release_slot_unprotected(lock, consumer);
+  const auto begin = clock::now();
+  wait_begin_unprotected(lock, wait_kind::not_empty);
+  cv.wait(lock, [this, id, consumer]() {
+    return has_items_unprotected(id) || has_marker_unprotected(consumer) || !active;
+  });
+  if (tuning) {
+    window.starved_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - begin).count();
   }
-  cv.wait(lock, [this, id]() { return has_items_unprotected(id) || !active; });
+  wait_end_unprotected(lock, wait_kind::not_empty, begin);
+  return begin;
+}
+
+std::optional<queue::clock::time_point> queue::sleep_until_items_available_until(int id,
+                                                                                node *consumer,
+                                                                                clock::time_point deadline) {
+  std::unique_lock lock(items_mut);
+  if (has_items_unprotected(id) || has_marker_unprotected(consumer)) {
+    return std::nullopt;
+  }
+  if (!active) {
+    return std::nullopt;
+  }
+  release_slot_unprotected(lock, consumer);
+  const auto begin = clock::now();
+  wait_begin_unprotected(lock, wait_kind::not_empty);
+  cv.wait_until(lock, deadline, [this, id, consumer]() {
+    return has_items_unprotected(id) || has_marker_unprotected(consumer) || !active;
+  });
+  if (tuning) {
+    window.starved_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - begin).count();
+  }
+  wait_end_unprotected(lock, wait_kind::not_empty, begin);
+  return begin;
+}
+
+size_t queue::lane_of(const std::shared_ptr<message_type> &value) const {
+  if (lanes.size() == 1 || !value) {
+    return 0;
+  }
+  return std::min(value->priority(), lanes.size() - 1);
 }
 
 void queue::push(std::shared_ptr<message_type> value) {
+  const auto prio = lane_of(value);
+  push(std::move(value), prio);
+}
+
+void queue::push(std::shared_ptr<message_type> value, size_t prio) {
+  if constexpr (instrumentation_enabled) {
+    if (instrumentation && value) instrumentation->on_push(*this, *value);
+  }
   {
     std::unique_lock scoped_lock(items_mut);
-    items.emplace_back(consumer_ids, std::move(value));
-    system.stats_.set_size(name, items.size());
+    prio = std::min(prio, lanes.size() - 1);
+    auto &l = lanes[prio];
+    const auto bytes = value ? value->byte_size() : 0;
+    if (recording && value) {
+      recording->record(value, clock::now());
+    }
+    // only multi-lane and self-tuning queues pay for the timestamp used for the wait time
+    const bool timed = lanes.size() > 1 || tuning;
+    l.items.push_back(item{consumer_ids, std::move(value), timed ? clock::now() : clock::time_point{}, bytes});
+    total_items++;
+    total_bytes += bytes;
+    if (bytes > 0) system.acquire_memory(bytes);
+    window.peak_items = std::max(window.peak_items, total_items);
+    system.stats_.set_size(name, total_items, total_bytes);
+    if (lanes.size() > 1) {
+      system.stats_.set_lane_size(name, prio, l.items.size());
+    }
+  }
+  cv.notify_all();
+}
+
+void queue::push_all(std::vector<std::shared_ptr<message_type>> values) {
+  if constexpr (instrumentation_enabled) {
+    for (const auto &value : values) {
+      if (instrumentation && value) instrumentation->on_push(*this, *value);
+    }
+  }
+  {
+    std::unique_lock scoped_lock(items_mut);
+    const auto now = lanes.size() > 1 || tuning ? clock::now() : clock::time_point{};
+    size_t pushed_bytes = 0;
+    for (auto &value : values) {
+      const auto prio = lane_of(value);
+      const auto bytes = value ? value->byte_size() : 0;
+      if (recording && value) {
+        recording->record(value, clock::now());
+      }
+      lanes[prio].items.push_back(item{consumer_ids, std::move(value), now, bytes});
+      total_items++;
+      total_bytes += bytes;
+      pushed_bytes += bytes;
+    }
+    if (pushed_bytes > 0) system.acquire_memory(pushed_bytes);
+    window.peak_items = std::max(window.peak_items, total_items);
+    system.stats_.set_size(name, total_items, total_bytes);
+    for (size_t i = 0; lanes.size() > 1 && i < lanes.size(); i++) {
+      system.stats_.set_lane_size(name, i, lanes[i].items.size());
+    }
+  }
+  cv.notify_all();
+}
+
+void queue::push_marker(std::shared_ptr<job_marker> marker) {
+  {
+    std::unique_lock scoped_lock(items_mut);
+    // wait for the marker from all providers, so everything belonging to the job precedes it
+    if (++marker_arrivals[marker->job] < provider_ptrs.size()) {
+      return;
+    }
+    marker_arrivals.erase(marker->job);
+    for (const auto &consumer : consumer_ptrs) {
+      pending_markers[consumer].push_back(marker);
+      markers_pending++;
+    }
   }
   cv.notify_all();
 }
@@ -59,8 +213,16 @@ bool queue::is_full() {
   return is_full_unprotected();
 }
 
-bool queue::is_full_unprotected() const {
-  return items.size() >= max_items;
+bool queue::is_full_unprotected(std::optional<size_t> lane) const {
+  // the byte limit is for the queue as a whole, an empty queue always takes one message however large
+  if (max_bytes > 0 && total_items > 0 && total_bytes >= max_bytes) {
+    return true;
+  }
+  if (!lane || lanes.size() == 1) {
+    return total_items >= max_items;
+  }
+  const auto &l = lanes[std::min(*lane, lanes.size() - 1)];
+  return l.items.size() >= l.max_items;
 }
 
 bool queue::has_items(int id) {
@@ -69,38 +231,102 @@ bool queue::has_items(int id) {
 }
 
 bool queue::has_items_unprotected(int id) {
-  return std::any_of(
-      items.begin(), items.end(), [&id](const auto &item) { return item.first.find(id) != item.first.end(); });
+  return std::any_of(lanes.begin(), lanes.end(), [&id](auto &l) { return find_item(l.items, id) != l.items.end(); });
+}
+
+std::optional<std::pair<size_t, std::deque<queue::item>::iterator>> queue::select_unprotected(int id) {
+  if (policy == lane_policy::strict || lanes.size() == 1) {
+    for (size_t i = 0; i < lanes.size(); i++) {
+      if (auto find = find_item(lanes[i].items, id); find != lanes[i].items.end()) {
+        return std::make_pair(i, find);
+      }
+    }
+    return std::nullopt;
+  }
+  // smooth weighted round-robin over the lanes that have something for this consumer
+  std::optional<size_t> selected;
+  int64_t total_weight = 0;
+  for (size_t i = 0; i < lanes.size(); i++) {
+    auto &l = lanes[i];
+    if (find_item(l.items, id) == l.items.end()) continue;
+    l.current_weight += l.weight;
+    total_weight += l.weight;
+    if (!selected || l.current_weight > lanes[*selected].current_weight) {
+      selected = i;
+    }
+  }
+  if (!selected) {
+    return std::nullopt;
+  }
+  auto &l = lanes[*selected];
+  l.current_weight -= total_weight;
+  return std::make_pair(*selected, find_item(l.items, id));
+}
+
+bool queue::has_marker_unprotected(node *consumer) {
+  if (!consumer) return false;
+  const auto find = pending_markers.find(consumer);
+  return find != pending_markers.end() && !find->second.empty();
 }
 
 std::shared_ptr<message_type> queue::pop(int id) {
   std::unique_lock lock(items_mut);
-  auto find = items.end();
   std::shared_ptr<message_type> ret = nullptr;
-  for (auto &pair : items) {
-    if (pair.first.find(id) != pair.first.end()) {
-      pair.first.erase(id);
-      if (!pair.first.empty()) {
-        ret = pair.second;
-      } else {
-        ret = std::move(pair.second);
+  if (const auto selected = select_unprotected(id)) {
+    auto [lane_index, find] = *selected;
+    auto &l = lanes[lane_index];
+    find->consumers.erase(id);
+    if (lanes.size() > 1) {
+      system.stats_.add_lane_wait(name, lane_index, clock::now() - find->pushed);
+    }
+    if (tuning) {
+      const auto now = clock::now();
+      window.latency_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(now - find->pushed).count();
+      window.popped++;
+      if (now - window.started >= tuning->interval) {
+        tune_unprotected(now);
       }
-      if (pair.first.empty()) {
-        find = std::find(items.begin(), items.end(), pair);
+    }
+    if (!find->consumers.empty()) {
+      ret = find->value;
+    } else {
+      // consumers of a broadcast share the message and its payload, it's only released by the last one
+      ret = std::move(find->value);
+      total_bytes -= find->bytes;
+      if (find->bytes > 0) system.release_memory(find->bytes);
+      l.items.erase(find);
+      total_items--;
+      system.stats_.set_size(name, total_items, total_bytes);
+      if (lanes.size() > 1) {
+        system.stats_.set_lane_size(name, lane_index, l.items.size());
       }
-      break;
     }
   }
-  if (find != items.end()) {
-    items.erase(find);
-    system.stats_.set_size(name, items.size());
-  }
-  if (bool is_empty = items.empty(); is_empty && terminating) {
+  if (bool is_empty = total_items == 0; is_empty && terminating) {
     deactivate(lock);
   } else {
     lock.unlock();
     cv.notify_all();
   }
+  if constexpr (instrumentation_enabled) {
+    if (instrumentation && ret) instrumentation->on_pop(*this, *ret);
+  }
+  return ret;
+}
+
+std::shared_ptr<job_marker> queue::pop_marker(node *consumer) {
+  if (markers_pending == 0) {
+    return nullptr;
+  }
+  std::unique_lock lock(items_mut);
+  // a marker is only handed out after the consumer processed all items preceding it
+  if (has_items_unprotected(consumer->id()) || !has_marker_unprotected(consumer)) {
+    return nullptr;
+  }
+  auto &markers = pending_markers[consumer];
+  auto ret = std::move(markers.front());
+  markers.pop_front();
+  markers_pending--;
   return ret;
 }
 
@@ -115,7 +341,7 @@ void queue::check_terminate() {
   if (terminate) {
     terminating = true;
     // deactivate now (otherwise after pop() of the last item)
-    if (items.empty()) {
+    if (total_items == 0) {
       deactivate(lock);
     }
   }
@@ -128,7 +354,75 @@ void queue::deactivate(std::unique_lock<std::mutex> &lock) {
   cv.notify_all();
 }
 
+void queue::release_slot_unprotected(std::unique_lock<std::mutex> &lock, node *waiter) {
+  // only once it's certain the waiter blocks, the wait checks its condition again afterwards
+  if (waiter && waiter->holding_slot()) {
+    lock.unlock();
+    waiter->release_slot();
+    lock.lock();
+  }
+}
+
+void queue::wait_begin_unprotected(std::unique_lock<std::mutex> &lock, wait_kind kind) {
+  if constexpr (instrumentation_enabled) {
+    if (instrumentation && instrumentation->observes_waits()) {
+      lock.unlock();
+      instrumentation->on_wait_begin(*this, kind);
+      lock.lock();
+    }
+  }
+}
+
+void queue::wait_end_unprotected(std::unique_lock<std::mutex> &lock, wait_kind kind, clock::time_point begin) {
+  if constexpr (instrumentation_enabled) {
+    if (instrumentation && instrumentation->observes_waits()) {
+      lock.unlock();
+      instrumentation->on_wait_end(*this, kind, clock::now() - begin);
+    }
+  }
+}
+
+void queue::cancel() {
+  std::unique_lock lock(items_mut);
+  if (active) {
+    deactivate(lock);
+  }
+}
+
+void queue::tune_unprotected(clock::time_point now) {
+  const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - window.started).count();
+  const auto latency = window.popped > 0 ? window.latency_ns / int64_t(window.popped) : 0;
+  const auto target = std::chrono::duration_cast<std::chrono::nanoseconds>(tuning->target_latency).count();
+  // Little's law: the number of items the consumers drain within the target latency
+  const auto within_target = size_t(std::max(int64_t(window.popped) * target / std::max(elapsed, int64_t(1)), int64_t(1)));
+  auto capacity = max_items;
+  if (latency > target) {
+    // items wait too long, buffer less
+    capacity = std::min(capacity * 3 / 4, within_target);
+  } else if (window.blocked_ns > window.starved_ns && window.blocked_ns > elapsed / 20) {
+    // producers stall on a full queue while there is latency to spare
+    capacity = std::min(capacity * 2, std::max(within_target, capacity));
+  } else if (window.blocked_ns == 0 && window.peak_items * 2 < capacity) {
+    // never came close to full, give back memory gradually
+    capacity = std::max(window.peak_items * 2, capacity / 2);
+  }
+  capacity = std::clamp(capacity, tuning->min_items, tuning->max_items);
+  // called from pop(), which wakes up the producers afterwards
+  if (capacity != max_items) {
+    max_items = capacity;
+    lanes[0].max_items = capacity;
+    system.stats_.set_capacity(name, capacity);
+  }
+  window = tuning_window{now};
+  window.peak_items = total_items;
+}
+
 size_t queue::size() {
   std::unique_lock lock(items_mut);
-  return items.size();
+  return total_items;
+}
+
+size_t queue::bytes() {
+  std::unique_lock lock(items_mut);
+  return total_bytes;
 }
@@ -0,0 +1,167 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "recording.h"
+
+#include <cstring>
+#include <thread>
+
+namespace {
+constexpr char magic[] = {'P', 'I', 'P', 'E', 'R', 'R', 'E', 'C'};
+constexpr char version = 1;
+
+void append_varint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(char(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(char(value));
+}
+}  // namespace
+
+void serialize_buffer_message(const message_type &msg, std::string &out) {
+  if (const auto *buffer = dynamic_cast<const buffer_message *>(&msg)) {
+    out.append(buffer->payload.data(), buffer->payload.size());
+  }
+}
+
+std::shared_ptr<message_type> deserialize_buffer_message(const buffer_slice &bytes) {
+  return std::make_shared<buffer_message>(bytes);
+}
+
+recorder::recorder(const std::string &filename, serialize_fun_t serialize)
+    : out(filename, std::ios::binary | std::ios::trunc), serialize(std::move(serialize)) {
+  out.write(magic, sizeof(magic));
+  out.put(version);
+  good_ = out.is_open() && out.good();
+  if (good_) {
+    writer = std::thread([this]() { run(); });
+  }
+}
+
+recorder::~recorder() {
+  close();
+}
+
+bool recorder::is_open() const {
+  return good_;
+}
+
+void recorder::record(std::shared_ptr<message_type> msg, clock::time_point now) {
+  {
+    std::scoped_lock lock(mut);
+    if (!writer.joinable() || stopping) {
+      return;
+    }
+    pending.push_back(pending_record{std::move(msg), now});
+  }
+  cv.notify_one();
+}
+
+void recorder::run() {
+  std::vector<pending_record> batch;
+  std::unique_lock lock(mut);
+  while (true) {
+    cv.wait(lock, [this]() { return !pending.empty() || stopping; });
+    if (pending.empty()) {
+      break;
+    }
+    batch.swap(pending);
+    lock.unlock();
+    for (const auto &r : batch) {
+      write(*r.msg, r.when);
+    }
+    // the messages are released outside the lock as well
+    batch.clear();
+    out.flush();
+    good_ = out.good();
+    lock.lock();
+  }
+}
+
+void recorder::write(const message_type &msg, clock::time_point now) {
+  const auto delta = records_ == 0 ? 0 : std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+  last = now;
+  // the message is serialized after the header so both can be written at once
+  buffer.clear();
+  append_varint(buffer, uint64_t(std::max(delta, int64_t(0))));
+  const auto header = buffer.size();
+  serialize(msg, buffer);
+  std::string size;
+  append_varint(size, buffer.size() - header);
+  buffer.insert(header, size);
+  out.write(buffer.data(), buffer.size());
+  records_++;
+}
+
+void recorder::close() {
+  {
+    std::scoped_lock lock(mut);
+    stopping = true;
+  }
+  cv.notify_one();
+  if (writer.joinable()) {
+    writer.join();
+  }
+  if (out.is_open()) {
+    out.close();
+  }
+}
+
+size_t recorder::records() const {
+  return records_;
+}
+
+replayer::replayer(const std::string &filename, deserialize_fun_t deserialize, replay_options options)
+    : deserialize(std::move(deserialize)), options(options) {
+  auto mapped = buffer_slice::map_file(filename);
+  if (!mapped || mapped->size() < sizeof(magic) + 1 ||
+      std::memcmp(mapped->data(), magic, sizeof(magic)) != 0 || mapped->data()[sizeof(magic)] != version) {
+    return;
+  }
+  recording = *mapped;
+  pos = sizeof(magic) + 1;
+  is_open_ = true;
+}
+
+bool replayer::is_open() const {
+  return is_open_;
+}
+
+bool replayer::read_varint(uint64_t &value) {
+  value = 0;
+  for (int shift = 0; pos < recording.size() && shift < 64; shift += 7) {
+    const auto byte = static_cast<unsigned char>(recording.data()[pos++]);
+    value |= uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::shared_ptr<message_type> replayer::next() {
+  uint64_t delta = 0;
+  uint64_t size = 0;
+  if (!is_open_ || !read_varint(delta) || !read_varint(size) || size > recording.size() - pos) {
+    return nullptr;
+  }
+  auto bytes = recording.slice(pos, size);
+  pos += size;
+  if (records_++ == 0) {
+    started = clock::now();
+  }
+  elapsed += std::chrono::nanoseconds(delta);
+  if (options.speed > 0) {
+    const auto scaled = std::chrono::duration_cast<clock::duration>(elapsed / options.speed);
+    std::this_thread::sleep_until(started + scaled);
+  }
+  return deserialize(bytes);
+}
+
+size_t replayer::records() const {
+  return records_;
+}
@@ -0,0 +1,323 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "simd_kernels.h"
+
+#include <algorithm>
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIPER_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// scalar
+
+void add_scalar(const double *a, const double *b, double *out, size_t n) {
+  for (size_t i = 0; i < n; i++) out[i] = a[i] + b[i];
+}
+void mul_scalar(const double *a, const double *b, double *out, size_t n) {
+  for (size_t i = 0; i < n; i++) out[i] = a[i] * b[i];
+}
+void add_s_scalar(const double *a, double s, double *out, size_t n) {
+  for (size_t i = 0; i < n; i++) out[i] = a[i] + s;
+}
+void mul_s_scalar(const double *a, double s, double *out, size_t n) {
+  for (size_t i = 0; i < n; i++) out[i] = a[i] * s;
+}
+void sum_of_squares_scalar(const double *a, const double *b, double *out, size_t n) {
+  for (size_t i = 0; i < n; i++) out[i] = a[i] * a[i] + b[i] * b[i];
+}
+size_t select_le_scalar(const double *a, double bound, uint32_t *out, size_t n) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) {
+    out[count] = uint32_t(i);
+    count += a[i] <= bound ? 1 : 0;
+  }
+  return count;
+}
+size_t count_le_scalar(const double *a, double bound, size_t n) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) count += a[i] <= bound ? 1 : 0;
+  return count;
+}
+double sum_scalar(const double *a, size_t n) {
+  double s = 0;
+  for (size_t i = 0; i < n; i++) s += a[i];
+  return s;
+}
+double sum_rows_scalar(const double *a, const uint32_t *rows, size_t n) {
+  double s = 0;
+  for (size_t i = 0; i < n; i++) s += a[rows[i]];
+  return s;
+}
+
+#ifdef PIPER_SIMD_X86
+
+// sse2, unaligned loads so raw pointers work too, on aligned columns they are as fast as aligned ones
+
+#define PIPER_SSE2 __attribute__((target("sse2")))
+
+PIPER_SSE2 void add_sse2(const double *a, const double *b, double *out, size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  add_scalar(a + i, b + i, out + i, n - i);
+}
+PIPER_SSE2 void mul_sse2(const double *a, const double *b, double *out, size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  mul_scalar(a + i, b + i, out + i, n - i);
+}
+PIPER_SSE2 void add_s_sse2(const double *a, double s, double *out, size_t n) {
+  const __m128d v = _mm_set1_pd(s);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(a + i), v));
+  add_s_scalar(a + i, s, out + i, n - i);
+}
+PIPER_SSE2 void mul_s_sse2(const double *a, double s, double *out, size_t n) {
+  const __m128d v = _mm_set1_pd(s);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), v));
+  mul_s_scalar(a + i, s, out + i, n - i);
+}
+PIPER_SSE2 void sum_of_squares_sse2(const double *a, const double *b, double *out, size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    const __m128d x = _mm_loadu_pd(a + i), y = _mm_loadu_pd(b + i);
+    _mm_storeu_pd(out + i, _mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y)));
+  }
+  sum_of_squares_scalar(a + i, b + i, out + i, n - i);
+}
+PIPER_SSE2 size_t select_le_sse2(const double *a, double bound, uint32_t *out, size_t n) {
+  const __m128d v = _mm_set1_pd(bound);
+  size_t count = 0, i = 0;
+  for (; i + 2 <= n; i += 2) {
+    const int mask = _mm_movemask_pd(_mm_cmple_pd(_mm_loadu_pd(a + i), v));
+    out[count] = uint32_t(i);
+    count += mask & 1;
+    out[count] = uint32_t(i + 1);
+    count += mask >> 1;
+  }
+  for (; i < n; i++) {
+    out[count] = uint32_t(i);
+    count += a[i] <= bound ? 1 : 0;
+  }
+  return count;
+}
+PIPER_SSE2 size_t count_le_sse2(const double *a, double bound, size_t n) {
+  const __m128d v = _mm_set1_pd(bound);
+  size_t count = 0, i = 0;
+  for (; i + 2 <= n; i += 2) {
+    count += __builtin_popcount(_mm_movemask_pd(_mm_cmple_pd(_mm_loadu_pd(a + i), v)));
+  }
+  return count + count_le_scalar(a + i, bound, n - i);
+}
+PIPER_SSE2 double sum_sse2(const double *a, size_t n) {
+  __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 = _mm_add_pd(s0, _mm_loadu_pd(a + i));
+    s1 = _mm_add_pd(s1, _mm_loadu_pd(a + i + 2));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+  return lanes[0] + lanes[1] + sum_scalar(a + i, n - i);
+}
+
+// avx2
+
+#define PIPER_AVX2 __attribute__((target("avx2,fma")))
+
+PIPER_AVX2 void add_avx2(const double *a, const double *b, double *out, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  add_scalar(a + i, b + i, out + i, n - i);
+}
+PIPER_AVX2 void mul_avx2(const double *a, const double *b, double *out, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  mul_scalar(a + i, b + i, out + i, n - i);
+}
+PIPER_AVX2 void add_s_avx2(const double *a, double s, double *out, size_t n) {
+  const __m256d v = _mm256_set1_pd(s);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), v));
+  add_s_scalar(a + i, s, out + i, n - i);
+}
+PIPER_AVX2 void mul_s_avx2(const double *a, double s, double *out, size_t n) {
+  const __m256d v = _mm256_set1_pd(s);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), v));
+  mul_s_scalar(a + i, s, out + i, n - i);
+}
+PIPER_AVX2 void sum_of_squares_avx2(const double *a, const double *b, double *out, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256d x = _mm256_loadu_pd(a + i), y = _mm256_loadu_pd(b + i);
+    _mm256_storeu_pd(out + i, _mm256_fmadd_pd(x, x, _mm256_mul_pd(y, y)));
+  }
+  sum_of_squares_scalar(a + i, b + i, out + i, n - i);
+}
+PIPER_AVX2 size_t select_le_avx2(const double *a, double bound, uint32_t *out, size_t n) {
+  const __m256d v = _mm256_set1_pd(bound);
+  size_t count = 0, i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const int mask = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(a + i), v, _CMP_LE_OQ));
+    // compress the matching indices: write all four, advance by the matches in order
+    for (int lane = 0; lane < 4; lane++) {
+      out[count] = uint32_t(i + lane);
+      count += (mask >> lane) & 1;
+    }
+  }
+  for (; i < n; i++) {
+    out[count] = uint32_t(i);
+    count += a[i] <= bound ? 1 : 0;
+  }
+  return count;
+}
+PIPER_AVX2 size_t count_le_avx2(const double *a, double bound, size_t n) {
+  const __m256d v = _mm256_set1_pd(bound);
+  size_t count = 0, i = 0;
+  for (; i + 4 <= n; i += 4) {
+    count += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(a + i), v, _CMP_LE_OQ)));
+  }
+  return count + count_le_scalar(a + i, bound, n - i);
+}
+PIPER_AVX2 double sum_avx2(const double *a, size_t n) {
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm256_add_pd(s0, _mm256_loadu_pd(a + i));
+    s1 = _mm256_add_pd(s1, _mm256_loadu_pd(a + i + 4));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, _mm256_add_pd(s0, s1));
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_scalar(a + i, n - i);
+}
+PIPER_AVX2 double sum_rows_avx2(const double *a, const uint32_t *rows, size_t n) {
+  __m256d s = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows + i));
+    s = _mm256_add_pd(s, _mm256_mask_i32gather_pd(_mm256_setzero_pd(), a, idx, _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, s);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_rows_scalar(a, rows + i, n - i);
+}
+#endif
+
+simd_level detect() {
+#ifdef PIPER_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return simd_level::avx2;
+  if (__builtin_cpu_supports("sse2")) return simd_level::sse2;
+#endif
+  return simd_level::scalar;
+}
+
+std::atomic<simd_level> &level() {
+  static std::atomic<simd_level> level{simd::detected()};
+  return level;
+}
+
+// picks the implementation for the active level
+#ifdef PIPER_SIMD_X86
+#define PIPER_DISPATCH(scalar_fun, sse2_fun, avx2_fun, ...) \
+  switch (level().load(std::memory_order_relaxed)) {       \
+    case simd_level::avx2:                                  \
+      return avx2_fun(__VA_ARGS__);                         \
+    case simd_level::sse2:                                  \
+      return sse2_fun(__VA_ARGS__);                         \
+    default:                                                \
+      return scalar_fun(__VA_ARGS__);                       \
+  }
+#else
+#define PIPER_DISPATCH(scalar_fun, sse2_fun, avx2_fun, ...) return scalar_fun(__VA_ARGS__);
+#endif
+
+}  // namespace
+
+namespace simd {
+simd_level detected() {
+  static const simd_level detected = detect();
+  return detected;
+}
+
+void force(simd_level l) {
+  if (l <= detected()) level() = l;
+}
+
+simd_level active() {
+  return level();
+}
+
+const char *to_string(simd_level l) {
+  switch (l) {
+    case simd_level::avx2:
+      return "avx2";
+    case simd_level::sse2:
+      return "sse2";
+    default:
+      return "scalar";
+  }
+}
+
+void add(const double *a, const double *b, double *out, size_t n) {
+  PIPER_DISPATCH(add_scalar, add_sse2, add_avx2, a, b, out, n);
+}
+void mul(const double *a, const double *b, double *out, size_t n) {
+  PIPER_DISPATCH(mul_scalar, mul_sse2, mul_avx2, a, b, out, n);
+}
+void add(const double *a, double s, double *out, size_t n) {
+  PIPER_DISPATCH(add_s_scalar, add_s_sse2, add_s_avx2, a, s, out, n);
+}
+void mul(const double *a, double s, double *out, size_t n) {
+  PIPER_DISPATCH(mul_s_scalar, mul_s_sse2, mul_s_avx2, a, s, out, n);
+}
+void sum_of_squares(const double *a, const double *b, double *out, size_t n) {
+  PIPER_DISPATCH(sum_of_squares_scalar, sum_of_squares_sse2, sum_of_squares_avx2, a, b, out, n);
+}
+size_t select_less_equal(const double *a, double bound, uint32_t *out, size_t n) {
+  PIPER_DISPATCH(select_le_scalar, select_le_sse2, select_le_avx2, a, bound, out, n);
+}
+size_t count_less_equal(const double *a, double bound, size_t n) {
+  PIPER_DISPATCH(count_le_scalar, count_le_sse2, count_le_avx2, a, bound, n);
+}
+double sum(const double *a, size_t n) {
+  PIPER_DISPATCH(sum_scalar, sum_sse2, sum_avx2, a, n);
+}
+double sum(const double *a, const uint32_t *rows, size_t n) {
+  // sse2 has no gather, the scalar loop is as fast
+  PIPER_DISPATCH(sum_rows_scalar, sum_rows_scalar, sum_rows_avx2, a, rows, n);
+}
+
+void sum_of_squares(const column<double> &a, const column<double> &b, column<double> &out) {
+  const auto n = std::min(a.size(), b.size());
+  out.resize(n);
+  sum_of_squares(a.data(), b.data(), out.data(), n);
+}
+
+selection select_less_equal(const column<double> &a, double bound) {
+  selection ret(a.size());
+  ret.resize(select_less_equal(a.data(), bound, ret.data(), a.size()));
+  return ret;
+}
+
+double sum(const column<double> &a) {
+  return sum(a.data(), a.size());
+}
+
+double sum(const column<double> &a, const selection &rows) {
+  return sum(a.data(), rows.data(), rows.size());
+}
+}  // namespace simd
@@ -6,6 +6,8 @@
 
 #include "stats.h"
 
+#include <cmath>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <thread>
@@ -14,6 +16,74 @@
 #include "queue.h"
 #include "util/a.hpp"
 
+namespace {
+std::string format_bytes(size_t bytes) {
+  const char* units[] = {"B", "K", "M", "G", "T"};
+  double value = bytes;
+  size_t unit = 0;
+  while (value >= 1024 && unit < 4) {
+    value /= 1024;
+    unit++;
+  }
+  std::stringstream ss;
+  ss.precision(unit == 0 || value >= 10 ? 0 : 1);
+  ss << std::fixed << value << units[unit];
+  return ss.str();
+}
+
+// strips the " #i" suffix replicate() gives to the nodes and queues of replica i
+std::string base_name(const std::string& name, size_t* replica = nullptr) {
+  const auto pos = name.rfind(" #");
+  if (pos == std::string::npos || pos + 2 == name.size() ||
+      name.find_first_not_of("0123456789", pos + 2) != std::string::npos) {
+    return name;
+  }
+  if (replica) *replica = std::stoul(name.substr(pos + 2));
+  return name.substr(0, pos);
+}
+
+std::map<std::string, stats::node_stats> merge_replicas(const std::map<std::string, stats::node_stats>& in) {
+  std::map<std::string, stats::node_stats> ret;
+  for (const auto& [name, s] : in) {
+    const auto base = base_name(name);
+    auto [it, inserted] = ret.emplace(base, s);
+    it->second.name = base;
+    if (inserted) continue;
+    auto& m = it->second;
+    m.is_sleeping_until_not_full |= s.is_sleeping_until_not_full;
+    m.is_sleeping_until_not_empty |= s.is_sleeping_until_not_empty;
+    m.active |= s.active;
+    m.size += s.size;
+    m.bytes += s.bytes;
+    m.capacity += s.capacity;
+    m.max_bytes += s.max_bytes;
+    m.counter += s.counter;
+    m.last_counter += s.last_counter;
+    m.bytes_counter += s.bytes_counter;
+    m.last_bytes_counter += s.last_bytes_counter;
+    m.errors += s.errors;
+    m.busy_ns += s.busy_ns;
+    m.blocked_on_input_ns += s.blocked_on_input_ns;
+    m.blocked_on_output_ns += s.blocked_on_output_ns;
+    m.throttled_ns += s.throttled_ns;
+    m.started = std::min(m.started, s.started);
+    m.stopped = std::max(m.stopped, s.stopped);
+    if (m.lanes.size() < s.lanes.size()) m.lanes.resize(s.lanes.size());
+    for (size_t i = 0; i < s.lanes.size(); i++) {
+      m.lanes[i].size += s.lanes[i].size;
+      m.lanes[i].popped += s.lanes[i].popped;
+      m.lanes[i].wait_ns += s.lanes[i].wait_ns;
+    }
+    if (s.perf) {
+      if (!m.perf) m.perf = perf_sample{};
+      *m.perf += *s.perf;
+    }
+    m.last_perf += s.last_perf;
+  }
+  return ret;
+}
+}  // namespace
+
 void stats::set_type(const std::string& name, bool is_storage) {
   std::scoped_lock sl(stats_mut);
   stats_[name].name = name;
@@ -21,6 +91,13 @@ void stats::set_type(const std::string& name, bool is_storage) {
   stats_[name].active = true;
   stats_[name].counter = 0;
   stats_[name].last_counter = 0;
+  stats_[name].bytes_counter = 0;
+  stats_[name].last_bytes_counter = 0;
+  stats_[name].errors = 0;
+  stats_[name].busy_ns = 0;
+  stats_[name].blocked_on_input_ns = 0;
+  stats_[name].blocked_on_output_ns = 0;
+  stats_[name].throttled_ns = 0;
 }
 
 void stats::set_sleep_until_not_full(const std::string& name, bool val) {
@@ -33,9 +110,35 @@ void stats::set_sleep_until_not_empty(const std::string& name, bool val) {
   stats_[name].is_sleeping_until_not_empty = val;
 }
 
-void stats::set_size(const std::string& name, int size) {
+void stats::set_size(const std::string& name, int size, size_t bytes) {
   std::scoped_lock sl(stats_mut);
   stats_[name].size = size;
+  stats_[name].bytes = bytes;
+}
+
+void stats::set_capacity(const std::string& name, size_t capacity) {
+  std::scoped_lock sl(stats_mut);
+  stats_[name].capacity = capacity;
+}
+
+void stats::set_max_bytes(const std::string& name, size_t max_bytes) {
+  std::scoped_lock sl(stats_mut);
+  stats_[name].max_bytes = max_bytes;
+}
+
+void stats::set_lane_size(const std::string& name, size_t lane, int size) {
+  std::scoped_lock sl(stats_mut);
+  auto& lanes = stats_[name].lanes;
+  if (lanes.size() <= lane) lanes.resize(lane + 1);
+  lanes[lane].size = size;
+}
+
+void stats::add_lane_wait(const std::string& name, size_t lane, std::chrono::nanoseconds wait) {
+  std::scoped_lock sl(stats_mut);
+  auto& lanes = stats_[name].lanes;
+  if (lanes.size() <= lane) lanes.resize(lane + 1);
+  lanes[lane].popped++;
+  lanes[lane].wait_ns += wait.count();
 }
 
 void stats::set_active(const std::string& name, bool active) {
@@ -47,29 +150,171 @@ void stats::add_counter(const std::string& name) {
   stats_[name].counter++;
 }
 
+void stats::add_bytes(const std::string& name, size_t bytes) {
+  std::scoped_lock sl(stats_mut);
+  stats_[name].bytes_counter += bytes;
+}
+
+void stats::add_errors(const std::string& name, size_t errors) {
+  std::scoped_lock sl(stats_mut);
+  stats_[name].errors += errors;
+}
+
+void stats::set_started(const std::string& name, std::chrono::steady_clock::time_point when) {
+  std::scoped_lock sl(stats_mut);
+  stats_[name].started = when;
+}
+
+void stats::set_stopped(const std::string& name, std::chrono::steady_clock::time_point when) {
+  std::scoped_lock sl(stats_mut);
+  stats_[name].stopped = when;
+}
+
+void stats::add_blocked_on_input(const std::string& name, std::chrono::nanoseconds blocked) {
+  std::scoped_lock sl(stats_mut);
+  stats_[name].blocked_on_input_ns += blocked.count();
+}
+
+void stats::add_blocked_on_output(const std::string& name, std::chrono::nanoseconds blocked) {
+  std::scoped_lock sl(stats_mut);
+  stats_[name].blocked_on_output_ns += blocked.count();
+}
+
+void stats::add_throttled(const std::string& name, std::chrono::nanoseconds throttled) {
+  std::scoped_lock sl(stats_mut);
+  stats_[name].throttled_ns += throttled.count();
+}
+
+void stats::set_perf_counters(const std::string& name, std::shared_ptr<perf_counters> counters) {
+  std::scoped_lock sl(stats_mut);
+  perf_counters_[name] = std::move(counters);
+}
+
+size_t stats::add_in_flight_bytes(size_t bytes) {
+  const auto now = in_flight_bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  auto peak = peak_bytes_.load(std::memory_order_relaxed);
+  while (now > peak && !peak_bytes_.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {
+  }
+  return now;
+}
+
+size_t stats::remove_in_flight_bytes(size_t bytes) {
+  return in_flight_bytes_.fetch_sub(bytes, std::memory_order_relaxed) - bytes;
+}
+
+void stats::set_memory_budget(size_t bytes) {
+  budget_bytes_ = bytes;
+}
+
+stats::memory_stats stats::get_memory() const {
+  return {in_flight_bytes_.load(), peak_bytes_.load(), budget_bytes_.load()};
+}
+
+void stats::set_cache(const std::string& name, std::shared_ptr<const cache_counters> counters) {
+  std::scoped_lock sl(stats_mut);
+  // replicas sharing one cache register it once, under the first of them
+  const auto base = base_name(name);
+  for (const auto& [other, registered] : caches_) {
+    if (registered == counters && base_name(other) == base) return;
+  }
+  caches_[name] = std::move(counters);
+}
+
+std::map<std::string, cache_stats> stats::get_caches() const {
+  std::scoped_lock sl(stats_mut);
+  return read_caches();
+}
+
+std::map<std::string, cache_stats> stats::read_caches() const {
+  std::map<std::string, cache_stats> ret;
+  for (const auto& [name, counters] : caches_) {
+    // replicas each have their own cache, summed up like their nodes
+    auto& c = ret[base_name(name)];
+    const auto s = counters->read();
+    c.hits += s.hits;
+    c.coalesced += s.coalesced;
+    c.misses += s.misses;
+    c.evictions += s.evictions;
+    c.entries += s.entries;
+    c.capacity += s.capacity;
+  }
+  return ret;
+}
+
+void stats::set_hedging(const std::string& name, std::shared_ptr<const hedge_group> group) {
+  std::scoped_lock sl(stats_mut);
+  hedging_[name] = std::move(group);
+}
+
+std::map<std::string, hedging_stats> stats::get_hedging() const {
+  std::scoped_lock sl(stats_mut);
+  return read_hedging();
+}
+
+std::map<std::string, hedging_stats> stats::read_hedging() const {
+  std::map<std::string, hedging_stats> ret;
+  for (const auto& [name, group] : hedging_) {
+    auto& h = ret[base_name(name)];
+    const auto s = group->read();
+    h.messages += s.messages;
+    h.hedged += s.hedged;
+    h.wins += s.wins;
+    h.threshold_ns = std::max(h.threshold_ns, s.threshold_ns);
+  }
+  return ret;
+}
+
+void stats::set_shutdown_deadline(std::chrono::steady_clock::time_point deadline) {
+  std::scoped_lock sl(stats_mut);
+  shutdown_deadline_ = deadline;
+}
+
+void stats::set_tenant(std::shared_ptr<fair_scheduler> scheduler, std::shared_ptr<fair_scheduler::tenant> tenant) {
+  std::scoped_lock sl(stats_mut);
+  scheduler_ = std::move(scheduler);
+  tenant_ = std::move(tenant);
+}
+
+std::optional<tenant_share> stats::get_cpu_share() const {
+  std::scoped_lock sl(stats_mut);
+  if (!scheduler_) return std::nullopt;
+  return scheduler_->share_of(*tenant_);
+}
+
+void stats::read_perf_counters(decltype(stats_)& into) const {
+  for (const auto& [name, counters] : perf_counters_) {
+    if (auto it = into.find(name); it != into.end()) it->second.perf = counters->read();
+  }
+}
+
 /**
  * This will be the only function in the stats class dealing with queues and nodes.
  * When displaying metrics we cannot assume these objects are still running.
  */
 void stats::setup(const std::vector<std::shared_ptr<queue>>& containers) {
   for (const auto& container : containers) {
+    // replicas share one picture, showing their merged numbers
+    size_t replica = 0;
+    base_name(container->name, &replica);
+    if (replica > 0) continue;
     size_t n = std::max(container->provider_ptrs.size(), container->consumer_ptrs.size());
     for (size_t i = 0; i < n; i++) {
       struct vis v;
       v.storage = "";
       if (i == 0) {
-        v.storage = container->name;
+        v.storage = base_name(container->name);
         v.input = "** external **";
       }
       if (i < container->provider_ptrs.size()) {
         auto provider = container->provider_ptrs[i];
-        v.input = provider->name();
+        v.input = base_name(provider->name());
       }
       if (i < container->consumer_ptrs.size()) {
         const auto consumer = container->consumer_ptrs[i];
-        v.output = consumer->name();
-        const auto tt = (*consumer->get_transform_type() == transform_type::same_workload ? "AND" : "OR");
-        v.output_tt = (consumer->get_transform_type() ? tt : "");
+        v.output = base_name(consumer->name());
+        if (const auto tt = consumer->get_transform_type()) {
+          v.output_tt = *tt == transform_type::same_workload ? "AND" : "OR";
+        }
       }
       lines.push_back(v);
     }
@@ -97,7 +342,16 @@ void stats::display() {
     }
     return ss.str();
   };
+  // nodes reporting bytes show their throughput instead of their message rate
+  auto rate = [&](const node_stats& s) {
+    if (s.bytes_counter > 0) {
+      return format_bytes(s.bytes_counter - s.last_bytes_counter) + "/s";
+    }
+    return std::to_string(s.counter - s.last_counter) + " FPS";
+  };
 
+  read_perf_counters(stats_);
+  auto merged = merge_replicas(stats_);
   bool first = true;
   for (const auto& line : lines) {
     auto inpu = fit_str(line.input, 17);
@@ -112,28 +366,41 @@ void stats::display() {
     auto ofp = fit_str("", 11);     // output fps (small);
     auto X = fit_str(line.output_tt, 10);
 
-    if (stats_.find(line.input) != stats_.end()) {
-      if (stats_[line.input].is_sleeping_until_not_empty) {
+    if (merged.find(line.input) != merged.end()) {
+      if (merged[line.input].is_sleeping_until_not_empty) {
         insl = fit_str("[sleeping]", 17);
       }
-      if (stats_[line.input].is_sleeping_until_not_full) {
+      if (merged[line.input].is_sleeping_until_not_full) {
         insl = fit_str("[sleeping]", 17);
       }
-      inpfps = fit_str(std::to_string(stats_[line.input].counter - stats_[line.input].last_counter) + " FPS", 19);
-      ifp = fit_str(std::to_string(stats_[line.input].counter - stats_[line.input].last_counter) + " FPS", 11);
+      inpfps = fit_str(rate(merged[line.input]), 19);
+      ifp = fit_str(rate(merged[line.input]), 11);
     }
-    if (stats_.find(line.output) != stats_.end()) {
-      if (stats_[line.output].is_sleeping_until_not_empty) {
+    if (merged.find(line.output) != merged.end()) {
+      if (merged[line.output].is_sleeping_until_not_empty) {
         ousl = fit_str("[sleeping]", 17);
       }
-      if (stats_[line.output].is_sleeping_until_not_full) {
+      if (merged[line.output].is_sleeping_until_not_full) {
         ousl = fit_str("[sleeping]", 17);
       }
-      outfps = fit_str(std::to_string(stats_[line.output].counter - stats_[line.output].last_counter) + " FPS", 19);
-      ofp = fit_str(std::to_string(stats_[line.output].counter - stats_[line.output].last_counter) + " FPS", 11);
+      if (merged[line.output].errors > 0) {
+        ousl = fit_str("[" + std::to_string(merged[line.output].errors) + " errors]", 17);
+      }
+      outfps = fit_str(rate(merged[line.output]), 19);
+      ofp = fit_str(rate(merged[line.output]), 11);
     }
-    if (stats_.find(line.storage) != stats_.end()) {
-      strq = fit_str("Q:" + std::to_string(stats_[line.storage].size), 15);
+    if (merged.find(line.storage) != merged.end()) {
+      auto q = "Q:" + std::to_string(merged[line.storage].size);
+      if (merged[line.storage].capacity > 0) {
+        q += "/" + std::to_string(merged[line.storage].capacity);
+      }
+      if (merged[line.storage].bytes > 0 || merged[line.storage].max_bytes > 0) {
+        q += " " + format_bytes(merged[line.storage].bytes);
+      }
+      if (merged[line.storage].max_bytes > 0) {
+        q += "/" + format_bytes(merged[line.storage].max_bytes);
+      }
+      strq = fit_str(q, 15);
     }
 
     // clang-format off
@@ -163,12 +430,91 @@ void stats::display() {
     // clang-format on
     first = false;
   }
+  if (const auto memory = get_memory(); memory.in_flight_bytes > 0 || memory.budget_bytes > 0) {
+    std::stringstream ss;
+    ss << "\nmemory: " << format_bytes(memory.in_flight_bytes);
+    if (memory.budget_bytes > 0) ss << " of " << format_bytes(memory.budget_bytes) << " budget";
+    ss << ", peak " << format_bytes(memory.peak_bytes);
+    a(std::cout) << ss.str() << std::endl;
+  }
+  if (shutdown_deadline_) {
+    size_t in_flight = 0;
+    for (const auto& [name, s] : stats_) {
+      if (s.is_storage) in_flight += s.size;
+    }
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(*shutdown_deadline_ -
+                                                                           std::chrono::steady_clock::now());
+    a(std::cout) << "shutting down: " << in_flight << " messages in flight, " << std::max(left.count(), int64_t(0))
+                 << " ms until the deadline" << std::endl;
+  }
+  for (const auto& [name, c] : read_caches()) {
+    std::stringstream ss;
+    ss << std::fixed;
+    ss.precision(1);
+    ss << "cache " << name << ": " << c.hit_ratio() * 100 << "% hits (" << c.coalesced << " coalesced), " << c.misses
+       << " misses, " << c.evictions << " evictions, " << c.entries << "/" << c.capacity << " entries";
+    a(std::cout) << ss.str() << std::endl;
+  }
+  for (const auto& [name, h] : read_hedging()) {
+    std::stringstream ss;
+    ss << std::fixed;
+    ss.precision(1);
+    ss << "hedging " << name << ": " << h.hedged << " of " << h.messages << " messages hedged ("
+       << h.hedge_ratio() * 100 << "%), " << h.wins << " won, threshold " << h.threshold_ns / 1e3 << " us";
+    a(std::cout) << ss.str() << std::endl;
+  }
+  if (scheduler_) {
+    const auto share = scheduler_->share_of(*tenant_);
+    std::stringstream ss;
+    ss << std::fixed;
+    ss.precision(1);
+    ss << "cpu share of " << share.name << ": " << share.share * 100 << "%, fair share " << share.fair_share * 100
+       << "%, waited " << share.wait_ns / 1e6 << " ms for threads";
+    a(std::cout) << ss.str() << std::endl;
+  }
+  // hardware and software counters of the last second, next to the rates above
+  bool perf_header = true;
+  for (const auto& [name, s] : merged) {
+    if (!s.perf) continue;
+    if (perf_header) {
+      a(std::cout) << "\n" << fit_str("node", 17) << "     IPC  cache misses/msg  switches/s  faults/s    cpu" << std::endl;
+      perf_header = false;
+    }
+    const auto delta = *s.perf - s.last_perf;
+    const auto messages = s.counter - s.last_counter;
+    std::stringstream ss;
+    ss << std::fixed;
+    ss.precision(2);
+    ss << fit_str(name, 17) << std::setw(8);
+    delta.hardware ? ss << delta.ipc() : ss << "-";
+    ss << std::setw(18);
+    ss.precision(1);
+    delta.hardware && messages > 0 ? ss << delta.cache_misses / double(messages) : ss << "-";
+    ss << std::setw(12) << delta.context_switches << std::setw(10) << delta.page_faults << std::setw(6)
+       << std::lround(delta.task_clock_ns / 1e7) << "%";
+    a(std::cout) << ss.str() << std::endl;
+  }
   for (auto& [_, stats] : stats_) {
     stats.last_counter = stats.counter;
+    stats.last_bytes_counter = stats.bytes_counter;
+    if (stats.perf) stats.last_perf = *stats.perf;
   }
 }
 
 std::map<std::string, stats::node_stats> stats::get_raw() const {
   std::scoped_lock lk(stats_mut);
-  return stats_;
+  auto ret = stats_;
+  read_perf_counters(ret);
+  const auto now = std::chrono::steady_clock::now();
+  for (auto& [_, s] : ret) {
+    if (s.is_storage || s.started == std::chrono::steady_clock::time_point{}) continue;
+    const auto until = s.stopped == std::chrono::steady_clock::time_point{} ? now : s.stopped;
+    const auto total = std::chrono::duration_cast<std::chrono::nanoseconds>(until - s.started).count();
+    s.busy_ns = std::max(total - s.blocked_on_input_ns - s.blocked_on_output_ns - s.throttled_ns, int64_t(0));
+  }
+  return ret;
+}
+
+std::map<std::string, stats::node_stats> stats::get_merged() const {
+  return merge_replicas(get_raw());
 }
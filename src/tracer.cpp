@@ -0,0 +1,125 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "tracer.h"
+
+#include <fstream>
+#include <iomanip>
+
+namespace {
+const char *kind_name(trace_kind kind) {
+  switch (kind) {
+    case trace_kind::produce:
+      return "produce";
+    case trace_kind::transform:
+      return "transform";
+    case trace_kind::consume:
+      return "consume";
+    case trace_kind::wait_input:
+      return "wait input";
+    case trace_kind::wait_output:
+      return "wait output";
+    case trace_kind::wakeup:
+      return "wakeup";
+  }
+  return "";
+}
+
+std::string escape(const std::string &in) {
+  std::string out;
+  for (const auto c : in) {
+    if (c == '"' || c == '\\') out += '\\';
+    if (static_cast<unsigned char>(c) < 0x20) continue;
+    out += c;
+  }
+  return out;
+}
+}  // namespace
+
+tracer::ring::ring(std::string thread_name, size_t capacity)
+    : thread_name(std::move(thread_name)), events(capacity) {}
+
+void tracer::enable(size_t sample_every, size_t events_per_thread) {
+  std::scoped_lock lock(rings_mut);
+  sample_every_ = std::max(sample_every, size_t(1));
+  // rings that are already registered keep their size
+  capacity_ = std::max(events_per_thread, size_t(1));
+  enabled_ = true;
+}
+
+void tracer::disable() {
+  enabled_ = false;
+}
+
+std::shared_ptr<tracer::ring> tracer::register_thread(const std::string &thread_name) {
+  std::scoped_lock lock(rings_mut);
+  auto r = std::make_shared<ring>(thread_name, capacity_);
+  rings.push_back(r);
+  return r;
+}
+
+void tracer::record(ring &r, trace_kind kind, clock::time_point begin, clock::time_point end) {
+  if (r.sample_counter++ % sample_every_.load(std::memory_order_relaxed) != 0) {
+    return;
+  }
+  const auto h = r.head.load(std::memory_order_relaxed);
+  auto &e = r.events[h % r.events.size()];
+  e.kind = kind;
+  e.begin_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - epoch_).count();
+  e.end_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - epoch_).count();
+  r.head.store(h + 1, std::memory_order_release);
+}
+
+void tracer::dump(std::ostream &os) {
+  std::vector<std::shared_ptr<ring>> copy;
+  {
+    std::scoped_lock lock(rings_mut);
+    copy = rings;
+  }
+  const auto flags = os.flags();
+  os << std::fixed << std::setprecision(3);
+  os << R"({"displayTimeUnit":"ns","traceEvents":[)";
+  bool first = true;
+  auto separator = [&]() -> std::ostream & {
+    if (!first) os << ",";
+    first = false;
+    return os << "\n";
+  };
+  for (size_t tid = 0; tid < copy.size(); tid++) {
+    auto &r = *copy[tid];
+    separator() << R"({"name":"thread_name","ph":"M","pid":1,"tid":)" << tid + 1 << R"(,"args":{"name":")"
+                << escape(r.thread_name) << R"("}})";
+
+    const uint64_t capacity = r.events.size();
+    const auto before = r.head.load(std::memory_order_acquire);
+    const auto from = before > capacity ? before - capacity : 0;
+    std::vector<event> events(r.events.begin(), r.events.end());
+    const auto after = r.head.load(std::memory_order_acquire);
+    for (auto i = from; i < before; i++) {
+      // the writer may have overwritten this slot (or be writing it) while we were copying
+      if (i + capacity <= after) continue;
+      const auto &e = events[i % capacity];
+      separator() << R"({"name":")" << kind_name(e.kind) << R"(","cat":"piper","pid":1,"tid":)" << tid + 1
+                  << R"(,"ts":)" << e.begin_ns / 1000.0;
+      if (e.kind == trace_kind::wakeup) {
+        os << R"(,"ph":"i","s":"t"})";
+      } else {
+        os << R"(,"ph":"X","dur":)" << (e.end_ns - e.begin_ns) / 1000.0 << "}";
+      }
+    }
+  }
+  os << "\n]}\n";
+  os.flags(flags);
+}
+
+bool tracer::dump(const std::string &filename) {
+  std::ofstream ofs(filename);
+  if (!ofs) {
+    return false;
+  }
+  dump(ofs);
+  return ofs.good();
+}
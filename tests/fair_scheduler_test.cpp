@@ -0,0 +1,42 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "fair_scheduler.h"
+#include "test.h"
+
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+// two tenants always competing for the one slot, each turn accounted as the same time, split the
+// turns by weight however the threads happen to be scheduled
+TEST(scheduler_shares_follow_weights) {
+  fair_scheduler scheduler(1);
+  const auto gold = scheduler.add_tenant("gold", 3);
+  const auto bronze = scheduler.add_tenant("bronze", 1);
+  std::atomic<size_t> competing = 0;
+  std::atomic<size_t> turns = 0;
+  auto compete = [&](fair_scheduler::tenant &t) {
+    competing++;
+    scheduler.acquire(t);
+    // turns taken before the other tenant showed up don't count, neither for the time nor the shares
+    while (competing < 2) {
+      scheduler.yield(t, std::chrono::milliseconds(0));
+    }
+    while (turns++ < 4000) {
+      // gives the slot back and queues up behind the other tenant, if that one is entitled to it
+      scheduler.yield(t, std::chrono::milliseconds(1));
+    }
+    scheduler.release(t, std::chrono::milliseconds(0));
+  };
+  std::thread first(compete, std::ref(*gold));
+  std::thread second(compete, std::ref(*bronze));
+  first.join();
+  second.join();
+  for (const auto &share : scheduler.shares()) {
+    EXPECT(std::abs(share.share - share.fair_share) <= 0.1);
+  }
+}
@@ -0,0 +1,20 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "file_io.h"
+#include "test.h"
+
+TEST(file_source_rejects_empty_chunks) {
+  file_source_options options;
+  options.mode = split_mode::fixed_size;
+  options.chunk_size = 0;
+  for (bool use_mmap : {true, false}) {
+    options.use_mmap = use_mmap;
+    file_source source(__FILE__, options);
+    EXPECT(!source.is_open());
+    EXPECT(source.next() == nullptr);
+  }
+}
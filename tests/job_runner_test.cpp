@@ -0,0 +1,44 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+#include "test.h"
+
+namespace {
+struct number : public message_type {
+  size_t i;
+  explicit number(size_t i) : i(i) {}
+};
+}  // namespace
+
+TEST(job_runner_through_router) {
+  pipeline_system system;
+  auto numbers = system.create_queue("numbers", 10);
+  auto even = system.create_queue("even", 10);
+  auto odd = system.create_queue("odd", 10);
+  auto results = system.create_queue("results", 10);
+
+  system.spawn_router<number>(
+      "split", [](auto n) { return n->i % 2; }, numbers, std::vector{even, odd});
+  auto pass = [](auto n) { return n; };
+  system.spawn_transformer<number>("even", pass, even, results);
+  system.spawn_transformer<number>("odd", pass, odd, results);
+  auto jobs = system.spawn_job_runner<number, size_t>(
+      "sum", [](size_t &sum, auto n) { sum += n->i; }, numbers, results);
+  system.start(false);
+
+  for (size_t max : {1, 2, 10, 100}) {
+    auto i = std::make_shared<size_t>(1);
+    auto result = jobs->submit([i, max]() -> std::shared_ptr<message_type> {
+      if (*i <= max) return std::make_shared<number>((*i)++);
+      return nullptr;
+    });
+    EXPECT(result.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    EXPECT(result.get() == max * (max + 1) / 2);
+  }
+  jobs->close();
+  system.explicit_join();
+}
@@ -0,0 +1,38 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "test.h"
+
+#include <iostream>
+
+std::map<std::string, std::function<void()>> &tests() {
+  static std::map<std::string, std::function<void()>> registry;
+  return registry;
+}
+
+// runs the named tests, or all of them without arguments
+int main(int argc, char *argv[]) {
+  std::map<std::string, std::function<void()>> selected;
+  for (int i = 1; i < argc; i++) {
+    const auto found = tests().find(argv[i]);
+    if (found == tests().end()) {
+      std::cerr << "unknown test " << argv[i] << std::endl;
+      return 1;
+    }
+    selected.insert(*found);
+  }
+  int failed = 0;
+  for (const auto &[name, fun] : argc > 1 ? selected : tests()) {
+    try {
+      fun();
+      std::cout << "ok " << name << std::endl;
+    } catch (const std::exception &e) {
+      std::cout << "FAILED " << name << ": " << e.what() << std::endl;
+      failed++;
+    }
+  }
+  return failed ? 1 : 0;
+}
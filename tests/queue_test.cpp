@@ -0,0 +1,24 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+#include "test.h"
+
+TEST(capacity_tuning_is_validated) {
+  pipeline_system system;
+  capacity_tuning empty;
+  empty.min_items = 0;
+  empty.max_items = 0;
+  EXPECT(system.create_queue("empty", empty)->tuning->min_items == 1);
+  EXPECT(system.create_queue("empty", empty)->max_items == 1);
+
+  capacity_tuning inverted;
+  inverted.min_items = 100;
+  inverted.max_items = 10;
+  const auto q = system.create_queue("inverted", inverted);
+  EXPECT(q->tuning->max_items == 100);
+  EXPECT(q->max_items == 100);
+}
@@ -0,0 +1,46 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+#include "test.h"
+
+#include <cstdio>
+
+TEST(recording_keeps_the_queue_order) {
+  const std::string filename = "recording_test.rec";
+  constexpr size_t count = 10000;
+  {
+    pipeline_system system;
+    auto lines = system.create_queue("lines", 100);
+    EXPECT(system.record(lines, filename, serialize_buffer_message));
+    for (int p = 0; p < 2; p++) {
+      system.spawn_producer(
+          "numbers " + std::to_string(p),
+          [i = size_t(0), p]() mutable -> std::shared_ptr<message_type> {
+            if (i == count / 2) return nullptr;
+            return std::make_shared<buffer_message>(
+                buffer_slice::copy_of(std::to_string(p) + ":" + std::to_string(i++)));
+          },
+          lines);
+    }
+    system.spawn_consumer<buffer_message>(
+        "drop", [](auto) {}, lines);
+    system.start();
+  }
+  // the recorder is closed with its queue, every message is on disk
+  replayer replay(filename, deserialize_buffer_message, replay_options{0});
+  EXPECT(replay.is_open());
+  size_t next[2] = {0, 0};
+  while (auto msg = replay.next()) {
+    const auto &payload = std::static_pointer_cast<buffer_message>(msg)->payload;
+    const std::string text(payload.data(), payload.size());
+    const auto p = size_t(text[0] - '0');
+    EXPECT(text == std::to_string(p) + ":" + std::to_string(next[p]));
+    next[p]++;
+  }
+  EXPECT(next[0] + next[1] == count);
+  std::remove(filename.c_str());
+}
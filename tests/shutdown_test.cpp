@@ -0,0 +1,33 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+#include "test.h"
+
+namespace {
+struct tick : public message_type {};
+}  // namespace
+
+// nodes waiting for a scheduler slot another tenant never gives back are woken at the deadline, so they
+// stop instead of being reported stuck and keeping the destructor waiting
+TEST(shutdown_wakes_scheduler_waiters) {
+  auto scheduler = std::make_shared<fair_scheduler>(1);
+  const auto hog = scheduler->add_tenant("hog");
+  EXPECT(scheduler->acquire(*hog));
+  {
+    pipeline_system system;
+    system.use_scheduler(scheduler, "starved");
+    auto q = system.create_queue("ticks", 10);
+    system.spawn_producer("ticks", []() { return std::make_shared<tick>(); }, q);
+    system.spawn_consumer<tick>(
+        "drop", [](auto) {}, q);
+    system.start(false);
+    const auto report = system.shutdown(std::chrono::milliseconds(50));
+    EXPECT(!report.drained);
+    EXPECT(report.stuck_nodes.empty());
+  }
+  scheduler->release(*hog, std::chrono::milliseconds(0));
+}
@@ -0,0 +1,31 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+// tests are registered by name, ctest runs each of them in its own process, see CMakeLists.txt
+std::map<std::string, std::function<void()>> &tests();
+
+struct test_registration {
+  test_registration(const std::string &name, std::function<void()> fun) {
+    tests()[name] = std::move(fun);
+  }
+};
+
+#define TEST(name)                                                \
+  static void name();                                             \
+  static test_registration name##_registration(#name, name);      \
+  static void name()
+
+#define EXPECT(condition)                                                                                \
+  if (!(condition)) {                                                                                    \
+    throw std::runtime_error(std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " #condition); \
+  }
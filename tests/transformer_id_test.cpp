@@ -0,0 +1,68 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "piper.h"
+#include "test.h"
+
+#include <atomic>
+
+namespace {
+struct number : public message_type {
+  size_t i;
+  explicit number(size_t i) : i(i) {}
+};
+
+constexpr size_t count = 1000;
+
+auto numbers_up_to_count() {
+  return [i = size_t(0)]() mutable -> std::shared_ptr<number> {
+    if (i == count) return nullptr;
+    return std::make_shared<number>(i++);
+  };
+}
+}  // namespace
+
+// transformers without a transform type are a same_pool: every message is transformed once
+TEST(untyped_transformers_share_a_pool) {
+  pipeline_system system;
+  auto in = system.create_queue("in", 10);
+  auto out = system.create_queue("out", 10);
+  system.spawn_producer("numbers", numbers_up_to_count(), in);
+  std::atomic<size_t> transformed = 0;
+  auto fun = [&](auto n) {
+    transformed++;
+    return n;
+  };
+  system.spawn_transformer<number>("first", fun, in, out);
+  system.spawn_transformer<number>("second", fun, in, out);
+  size_t consumed = 0;
+  system.spawn_consumer<number>(
+      "count", [&](auto) { consumed++; }, out);
+  system.start();
+  EXPECT(transformed == count);
+  EXPECT(consumed == count);
+}
+
+// same_workload transformers each get every message, and nothing waits for a pool nobody joined, which
+// used to fill the input queue up and hang
+TEST(same_workload_transformers_get_every_message) {
+  pipeline_system system;
+  auto in = system.create_queue("in", 10);
+  auto left = system.create_queue("left", 10);
+  auto right = system.create_queue("right", 10);
+  system.spawn_producer("numbers", numbers_up_to_count(), in);
+  auto pass = [](auto n) { return n; };
+  system.spawn_transformer<number>("left", pass, in, left, transform_type::same_workload);
+  system.spawn_transformer<number>("right", pass, in, right, transform_type::same_workload);
+  size_t left_count = 0, right_count = 0;
+  system.spawn_consumer<number>(
+      "left count", [&](auto) { left_count++; }, left);
+  system.spawn_consumer<number>(
+      "right count", [&](auto) { right_count++; }, right);
+  system.start();
+  EXPECT(left_count == count);
+  EXPECT(right_count == count);
+}